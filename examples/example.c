@@ -10,6 +10,8 @@
  *
  */
 int main(void) {
+    logger_install_crash_handler();
+
     /*
      * Unspecified Logger - Stdout
      */
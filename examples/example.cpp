@@ -0,0 +1,56 @@
+#include <string>
+#include <string_view>
+
+#include "logger.hpp"
+
+
+/*
+ * A user type made loggable by specializing liblogger::formatter
+ */
+struct point_t {
+    int x;
+    int y;
+};
+
+template <>
+struct liblogger::formatter<point_t> {
+    static void format(liblogger::buffer &out, const point_t &point) {
+        out.push_back('(');
+        liblogger::formatter<int>::format(out, point.x);
+        out.append(", ", 2);
+        liblogger::formatter<int>::format(out, point.y);
+        out.push_back(')');
+    }
+};
+
+/*
+ *
+ */
+int main() {
+    const std::string route = "/api/v1/users";
+    const std::string_view method = "GET";
+    const point_t point = {3, -4};
+
+    /*
+     * Stream Logger - Stdout
+     */
+    auto logger = liblogger::logger::stream("StreamLogger - C++", LOG_LEVEL_DEBUG, stdout);
+    logger.debug(LIBLOGGER_FORMAT("{} {} took {}us"), method, route, 42);
+    logger.notice(LIBLOGGER_FORMAT("ratio: {}, enabled: {}"), 0.75, true);
+    logger.info(LIBLOGGER_FORMAT("point: {}"), point);
+    logger.warning(LIBLOGGER_FORMAT("literal braces: {{}}, pointer: {}"), static_cast<const void *>(&point));
+    logger.error(LIBLOGGER_FORMAT("no arguments"));
+    logger.fatal(LIBLOGGER_FORMAT("{}{}{}"), 'a', "b", std::string("c"));
+
+    /*
+     * Rotating File Logger, released at the end of the scope
+     */
+    {
+        auto file_logger = liblogger::logger::rotating("RotatingFileLogger - C++", LOG_LEVEL_INFO, "/tmp/rotating-file-logger-cpp.log", 256);
+        for (int i = 0; i < 16; i++) {
+            file_logger.info(LIBLOGGER_FORMAT("record {} of {}"), i, 16);
+        }
+    }
+
+    return 0;
+}
@@ -6,15 +6,30 @@
  *  email:  daddinuz@gmail.com
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
 
 #include "ansicolor-w32/ansicolor-w32.h"
 #include "extname/extname.h"
 #include "logger.h"
+#include "logger_index.h"
+#include "logger_frame.h"
+#include "logger_shm.h"
 
 
 /*
@@ -104,19 +119,225 @@ typedef enum _log_policy_t {
     _LOG_POLICY_BUFFER
 } _log_policy_t;
 
+/*
+ * _frame_sink_t forward declaration
+ */
+typedef struct _frame_sink_t _frame_sink_t;
+
+/*
+ * _direct_sink_t forward declaration
+ */
+typedef struct _direct_sink_t _direct_sink_t;
+
+/*
+ * _shm_sink_t forward declaration
+ */
+typedef struct _shm_sink_t _shm_sink_t;
+
+/*
+ * _staging_t forward declaration
+ */
+typedef struct _staging_t _staging_t;
+
+static void _staging_delete(logger_t *logger);
+
 /*
  * logger_t definition
  */
 struct logger_t {
     FILE *_fd;
+    int _raw_fd;         /** descriptor backing _fd, cached for the crash handler **/
     char *_file_path;    /** if NULL is a stream logger otherwise is a file logger **/
     char *_identifier;
     log_level_t _level;
     _log_policy_t _policy;
     size_t _policy_bytes;
     size_t _written_bytes;
+    FILE *_index_fd;                    /** sidecar index, NULL if disabled **/
+    size_t _index_records;              /** records per index entry **/
+    logger_index_entry_t _index_entry;  /** group being accumulated **/
+    _frame_sink_t *_frame;              /** compressed sink behind _fd, NULL if disabled **/
+    log_compression_t _compression;
+    size_t _block_size;                 /** 0 if compression is disabled **/
+    log_threshold_t _threshold;
+    _direct_sink_t *_direct;            /** direct I/O sink behind _fd, NULL if disabled **/
+    size_t _direct_block_size;          /** 0 if direct I/O is disabled **/
+    _shm_sink_t *_shm;                  /** shared memory sink behind _fd, NULL if not a shm logger **/
+    _staging_t *_staging;               /** per-thread staging buffers, NULL if disabled **/
+    log_clock_t _clock;
+    log_level_t _record_level;          /** level of the record being written **/
+    int64_t _record_time;               /** timestamp of the record being written, nanoseconds since the epoch **/
+    uint64_t _record_sequence;          /** sequence number of the record being written **/
 };
 
+/*
+ * Live loggers registry
+ *
+ * A fixed table of pointers updated with atomic compare-and-swap, so that the
+ * crash handler can walk it without taking locks or allocating memory.
+ * Loggers that do not fit in the table are simply not drained on crash.
+ */
+#define _LOGGER_REGISTRY_CAPACITY   64
+
+static logger_t *volatile _logger_registry[_LOGGER_REGISTRY_CAPACITY];
+
+static void _logger_registry_add(logger_t *logger) {
+    size_t i;
+    for (i = 0; i < _LOGGER_REGISTRY_CAPACITY; i++) {
+        if (__sync_bool_compare_and_swap(&_logger_registry[i], NULL, logger)) {
+            return;
+        }
+    }
+}
+
+static void _logger_registry_remove(logger_t *logger) {
+    size_t i;
+    for (i = 0; i < _LOGGER_REGISTRY_CAPACITY; i++) {
+        if (__sync_bool_compare_and_swap(&_logger_registry[i], logger, NULL)) {
+            return;
+        }
+    }
+}
+
+/*
+ * Clocks
+ *
+ * Timestamps are nanoseconds since the epoch taken from the vDSO backed
+ * CLOCK_REALTIME(_COARSE), or from the TSC when it is invariant: the TSC is
+ * calibrated against CLOCK_REALTIME and then read without leaving user space,
+ * re-anchored once a second so that it follows NTP instead of drifting away.
+ */
+#define _TSC_CALIBRATION_NS     10000000
+#define _TSC_ANCHOR_NS          1000000000
+#define _TSC_MAX_RATE_CHANGE    0.001
+
+static uint64_t _sequence = 0;
+
+/*
+ * The current anchor is one of two slots: the other one is rewritten and then
+ * published, a reader would have to stall for a whole second to see it change.
+ */
+typedef struct _tsc_anchor_t {
+    uint64_t tsc;
+    int64_t ns;                 /** CLOCK_REALTIME when tsc was read **/
+    double ns_per_tick;
+    uint64_t expires;           /** tsc at which the anchor is renewed **/
+} _tsc_anchor_t;
+
+static int _tsc_calibrated = 0;
+static _tsc_anchor_t _tsc_anchors[2];
+static int _tsc_current = 0;
+static int _tsc_anchoring = 0;
+
+static int64_t _clock_realtime(clockid_t id) {
+    struct timespec now;
+    clock_gettime(id, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static void _tsc_anchor(_tsc_anchor_t *anchor, const _tsc_anchor_t *previous) {
+    double ns_per_tick;
+
+    anchor->ns = _clock_realtime(CLOCK_REALTIME);
+    anchor->tsc = __builtin_ia32_rdtsc();
+    ns_per_tick = (double) (anchor->ns - previous->ns) / (double) (anchor->tsc - previous->tsc);
+    /* NTP slews by at most 500ppm: a larger change is a clock step, which must not skew the rate */
+    if (ns_per_tick > previous->ns_per_tick * (1.0 + _TSC_MAX_RATE_CHANGE) ||
+        ns_per_tick < previous->ns_per_tick * (1.0 - _TSC_MAX_RATE_CHANGE)) {
+        ns_per_tick = previous->ns_per_tick;
+    }
+    anchor->ns_per_tick = ns_per_tick;
+    anchor->expires = anchor->tsc + (uint64_t) (_TSC_ANCHOR_NS / ns_per_tick);
+}
+
+static int _tsc_calibrate(void) {
+    unsigned int eax, ebx, ecx, edx;
+    _tsc_anchor_t start;
+
+    if (_tsc_calibrated) {
+        return 1;
+    }
+    /* CPUID.80000007H:EDX[8] tells whether the TSC ticks at a constant rate across P/C-states */
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || 0 == (edx & (1u << 8))) {
+        return 0;
+    }
+    start.ns = _clock_realtime(CLOCK_REALTIME);
+    start.tsc = __builtin_ia32_rdtsc();
+    do {
+        _tsc_anchors[0].ns = _clock_realtime(CLOCK_REALTIME);
+        _tsc_anchors[0].tsc = __builtin_ia32_rdtsc();
+    } while (_tsc_anchors[0].ns - start.ns < _TSC_CALIBRATION_NS);
+    _tsc_anchors[0].ns_per_tick = (double) (_tsc_anchors[0].ns - start.ns) / (double) (_tsc_anchors[0].tsc - start.tsc);
+    _tsc_anchors[0].expires = _tsc_anchors[0].tsc + (uint64_t) (_TSC_ANCHOR_NS / _tsc_anchors[0].ns_per_tick);
+    __atomic_store_n(&_tsc_current, 0, __ATOMIC_RELEASE);
+    _tsc_calibrated = 1;
+    return 1;
+}
+
+static int64_t _clock_tsc(void) {
+    int current = __atomic_load_n(&_tsc_current, __ATOMIC_ACQUIRE);
+    const _tsc_anchor_t *anchor = &_tsc_anchors[current];
+    uint64_t tsc = __builtin_ia32_rdtsc();
+
+    /* a single thread renews the anchor, the others keep using the current one meanwhile */
+    if (tsc >= anchor->expires && !__atomic_exchange_n(&_tsc_anchoring, 1, __ATOMIC_ACQUIRE)) {
+        _tsc_anchor(&_tsc_anchors[current ^ 1], anchor);
+        __atomic_store_n(&_tsc_current, current ^ 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&_tsc_anchoring, 0, __ATOMIC_RELEASE);
+        return _tsc_anchors[current ^ 1].ns;
+    }
+    return anchor->ns + (int64_t) ((double) (int64_t) (tsc - anchor->tsc) * anchor->ns_per_tick);
+}
+#else
+static int _tsc_calibrate(void) {
+    return 0;
+}
+
+static int64_t _clock_tsc(void) {
+    return _clock_realtime(CLOCK_REALTIME);
+}
+#endif
+
+static int64_t _clock_now(logger_t *logger) {
+    switch (logger->_clock) {
+#ifdef __linux__
+        case LOG_CLOCK_REALTIME_COARSE:
+            return _clock_realtime(CLOCK_REALTIME_COARSE);
+#endif
+        case LOG_CLOCK_TSC:
+            return _clock_tsc();
+        default:
+            return _clock_realtime(CLOCK_REALTIME);
+    }
+}
+
+/*
+ * Common logger initialization, to be called once the sink is in place
+ */
+static void _logger_init(logger_t *logger, const char *identifier, log_level_t level, _log_policy_t policy, size_t bytes) {
+    logger->_identifier = _string_new((NULL != identifier) ? identifier : "unknown");
+    logger->_level = (LOG_LEVEL_DEBUG == level && NDEBUG != 0) ? LOG_LEVEL_NOTICE : level;
+    logger->_policy = policy;
+    logger->_policy_bytes = bytes;
+    logger->_written_bytes = 0;
+    logger->_index_fd = NULL;
+    logger->_index_records = 0;
+    memset(&logger->_index_entry, 0, sizeof(logger->_index_entry));
+    logger->_frame = NULL;
+    logger->_compression = LOG_COMPRESSION_NONE;
+    logger->_block_size = 0;
+    logger->_threshold = LOG_THRESHOLD_RAW;
+    logger->_direct = NULL;
+    logger->_direct_block_size = 0;
+    logger->_staging = NULL;
+    logger->_clock = LOG_CLOCK_REALTIME;
+    logger->_record_level = LOG_LEVEL_DEBUG;
+    logger->_record_time = 0;
+    logger->_record_sequence = 0;
+    _logger_registry_add(logger);
+}
+
 /*
  * Stream logger constructor
  */
@@ -126,12 +347,10 @@ logger_t * stream_logger_new(const char *identifier, log_level_t level, FILE *st
         return NULL;
     }
     logger->_fd = (NULL != stream) ? stream : stderr;
+    logger->_raw_fd = fileno(logger->_fd);
     logger->_file_path = NULL;
-    logger->_identifier = _string_new((NULL != identifier) ? identifier : "unknown");
-    logger->_level = (LOG_LEVEL_DEBUG == level && NDEBUG != 0) ? LOG_LEVEL_NOTICE : level;
-    logger->_policy = _LOG_POLICY_NONE;
-    logger->_policy_bytes = 0;
-    logger->_written_bytes = 0;
+    logger->_shm = NULL;
+    _logger_init(logger, identifier, level, _LOG_POLICY_NONE, 0);
     return logger;
 }
 
@@ -140,6 +359,506 @@ logger_t * stream_logger_new(const char *identifier, log_level_t level, FILE *st
  */
 #define _IS_FILE_LOGGER(_Logger)     ((NULL == (_Logger)->_file_path) ? 0 : 1)
 #define _FILE_LOGGER_MODE(_Mode)     ((LOG_MODE_APPEND == _Mode) ? "a" : "w")
+#define _IS_INDEXED(_Logger)         ((NULL == (_Logger)->_index_fd) ? 0 : 1)
+
+/*
+ * Sidecar index utils
+ */
+static void _index_open(logger_t *logger) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && !_IS_INDEXED(logger));
+    logger_index_header_t header;
+    char *index_path = _string_cat(logger->_file_path, LOGGER_INDEX_EXTENSION);
+
+    /* an empty log file means a fresh segment: stale index entries must go */
+    fseek(logger->_fd, 0, SEEK_END);
+    logger->_index_fd = fopen(index_path, (0 == ftell(logger->_fd)) ? "wb" : "ab");
+    if (NULL == logger->_index_fd) {
+        fprintf(stderr, "Unable to open file: '%s'\n", index_path);
+        abort();
+    }
+    free(index_path);
+
+    fseek(logger->_index_fd, 0, SEEK_END);
+    if (0 == ftell(logger->_index_fd)) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOGGER_INDEX_MAGIC, sizeof(header.magic));
+        header.version = LOGGER_INDEX_VERSION;
+        header.records = (uint32_t) logger->_index_records;
+        fwrite(&header, sizeof(header), 1, logger->_index_fd);
+        fflush(logger->_index_fd);
+    }
+    memset(&logger->_index_entry, 0, sizeof(logger->_index_entry));
+}
+
+static void _index_flush_entry(logger_t *logger) {
+    assert(NULL != logger && _IS_INDEXED(logger));
+    if (logger->_index_entry.count > 0) {
+        fwrite(&logger->_index_entry, sizeof(logger->_index_entry), 1, logger->_index_fd);
+        fflush(logger->_index_fd);
+        memset(&logger->_index_entry, 0, sizeof(logger->_index_entry));
+    }
+}
+
+static void _index_close(logger_t *logger) {
+    assert(NULL != logger && _IS_INDEXED(logger));
+    _index_flush_entry(logger);
+    fclose(logger->_index_fd);
+    logger->_index_fd = NULL;
+}
+
+static void _index_begin_record(logger_t *logger) {
+    assert(NULL != logger && _IS_INDEXED(logger));
+    if (0 == logger->_index_entry.count) {
+        logger->_index_entry.offset = (uint64_t) ftell(logger->_fd);
+    }
+}
+
+static void _index_end_record(logger_t *logger, log_level_t level, int64_t ns, size_t bytes) {
+    assert(NULL != logger && _IS_INDEXED(logger));
+    logger_index_entry_t *entry = &logger->_index_entry;
+    if (0 == entry->count || ns < entry->min_ns) {
+        entry->min_ns = ns;
+    }
+    if (0 == entry->count || ns > entry->max_ns) {
+        entry->max_ns = ns;
+    }
+    entry->length += bytes;
+    entry->levels |= 1u << level;
+    entry->count += 1;
+    if (entry->count >= logger->_index_records) {
+        _index_flush_entry(logger);
+    }
+}
+
+/*
+ * Compressed sink
+ *
+ * A stdio cookie stream put in front of the log file: records are accumulated
+ * in a block which is compressed and appended to the file once it fills up.
+ */
+#define _FRAME_DEFAULT_BLOCK_SIZE   65536
+
+struct _frame_sink_t {
+    FILE *file;
+    int fd;
+    uint32_t codec;
+    char *block;
+    size_t block_size;
+    size_t block_length;
+    char *stored;
+    size_t stored_capacity;
+    uint64_t raw_offset;        /** uncompressed bytes in the emitted blocks **/
+    uint64_t stored_bytes;      /** bytes written to the file **/
+};
+
+#ifdef __GLIBC__
+
+static void _frame_sink_emit(_frame_sink_t *sink) {
+    logger_frame_block_t block;
+    const char *payload = sink->stored;
+    size_t stored_length;
+
+    if (0 == sink->block_length) {
+        return;
+    }
+
+    memset(&block, 0, sizeof(block));
+    memcpy(block.magic, LOGGER_FRAME_BLOCK_MAGIC, sizeof(block.magic));
+    block.codec = sink->codec;
+    block.raw_offset = sink->raw_offset;
+    block.raw_length = (uint32_t) sink->block_length;
+    stored_length = logger_frame_compress(sink->codec, sink->block, sink->block_length, sink->stored, sink->stored_capacity);
+    if (0 == stored_length || stored_length >= sink->block_length) {
+        /* incompressible data is stored as-is */
+        block.codec = LOGGER_FRAME_CODEC_NONE;
+        payload = sink->block;
+        stored_length = sink->block_length;
+    }
+    block.stored_length = (uint32_t) stored_length;
+
+    fwrite(&block, sizeof(block), 1, sink->file);
+    fwrite(payload, 1, stored_length, sink->file);
+    fflush(sink->file);
+    sink->raw_offset += sink->block_length;
+    sink->stored_bytes += sizeof(block) + stored_length;
+    sink->block_length = 0;
+}
+
+static ssize_t _frame_sink_write(void *cookie, const char *data, size_t size) {
+    _frame_sink_t *sink = cookie;
+    size_t written = 0, n;
+    while (written < size) {
+        n = sink->block_size - sink->block_length;
+        n = (n < size - written) ? n : size - written;
+        memcpy(sink->block + sink->block_length, data + written, n);
+        sink->block_length += n;
+        written += n;
+        if (sink->block_length == sink->block_size) {
+            _frame_sink_emit(sink);
+        }
+    }
+    return (ssize_t) size;
+}
+
+/*
+ * Only reports the position in the uncompressed stream, which is what ftell() returns.
+ */
+static int _frame_sink_seek(void *cookie, off64_t *position, int whence) {
+    _frame_sink_t *sink = cookie;
+    if (0 != *position || SEEK_SET == whence) {
+        return -1;
+    }
+    *position = (off64_t) (sink->raw_offset + sink->block_length);
+    return 0;
+}
+
+static int _frame_sink_close(void *cookie) {
+    _frame_sink_t *sink = cookie;
+    _frame_sink_emit(sink);
+    fclose(sink->file);
+    free(sink->stored);
+    free(sink->block);
+    free(sink);
+    return 0;
+}
+
+static _frame_sink_t *_frame_sink_new(FILE *file, const char *file_path, uint32_t codec, size_t block_size) {
+    logger_frame_header_t header;
+    logger_frame_entry_t *entries, *last;
+    FILE *existing;
+    size_t count;
+    _frame_sink_t *sink = malloc(sizeof(_frame_sink_t));
+    if (NULL == sink) {
+        abort();
+    }
+    sink->file = file;
+    sink->fd = fileno(file);
+    sink->codec = codec;
+    sink->block_size = block_size;
+    sink->block_length = 0;
+    sink->stored_capacity = logger_frame_bound(codec, block_size);
+    sink->block = malloc(block_size);
+    sink->stored = malloc(sink->stored_capacity);
+    if (NULL == sink->block || NULL == sink->stored) {
+        abort();
+    }
+    sink->raw_offset = 0;
+    sink->stored_bytes = 0;
+
+    fseek(file, 0, SEEK_END);
+    if (0 == ftell(file)) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOGGER_FRAME_MAGIC, sizeof(header.magic));
+        header.version = LOGGER_FRAME_VERSION;
+        header.block_size = (uint32_t) block_size;
+        fwrite(&header, sizeof(header), 1, file);
+        fflush(file);
+        sink->stored_bytes = sizeof(header);
+        return sink;
+    }
+
+    /* appending: resume after the last complete block, dropping a torn one if any */
+    existing = fopen(file_path, "rb");
+    entries = (NULL != existing) ? logger_frame_scan(existing, &count) : NULL;
+    if (NULL == entries) {
+        fprintf(stderr, "Not a compressed log file: '%s'\n", file_path);
+        abort();
+    }
+    fclose(existing);
+    if (count > 0) {
+        last = &entries[count - 1];
+        sink->raw_offset = last->block.raw_offset + last->block.raw_length;
+        if (0 != ftruncate(sink->fd, (off_t) (last->offset + last->block.stored_length))) {
+            fprintf(stderr, "Unable to truncate file: '%s'\n", file_path);
+            abort();
+        }
+    } else if (0 != ftruncate(sink->fd, (off_t) sizeof(header))) {
+        fprintf(stderr, "Unable to truncate file: '%s'\n", file_path);
+        abort();
+    }
+    free(entries);
+    return sink;
+}
+
+static void _file_logger_attach_frame(logger_t *logger) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_frame && logger->_block_size > 0);
+    cookie_io_functions_t functions;
+    _frame_sink_t *sink = _frame_sink_new(logger->_fd, logger->_file_path, (uint32_t) logger->_compression, logger->_block_size);
+
+    functions.read = NULL;
+    functions.write = _frame_sink_write;
+    functions.seek = _frame_sink_seek;
+    functions.close = _frame_sink_close;
+    logger->_fd = fopencookie(sink, "w", functions);
+    if (NULL == logger->_fd) {
+        abort();
+    }
+    logger->_raw_fd = fileno(logger->_fd);
+    logger->_frame = sink;
+}
+
+#else
+
+/*
+ * Cookie streams are a glibc extension: elsewhere records are written uncompressed.
+ */
+static void _file_logger_attach_frame(logger_t *logger) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_frame && logger->_block_size > 0);
+    fprintf(stderr, "Compression not supported on this platform, records will be written uncompressed\n");
+    logger->_block_size = 0;
+}
+
+#endif
+
+/*
+ * Direct I/O sink
+ *
+ * A stdio cookie stream put in front of the log file, whose descriptor is switched
+ * to O_DIRECT: records are staged in two aligned blocks, one being filled while a
+ * writer thread writes the other out. The file is preallocated a segment at a time
+ * with fallocate(2); the last partial block is written padded and then truncated.
+ */
+#define _DIRECT_ALIGNMENT           4096
+#define _DIRECT_DEFAULT_BLOCK_SIZE  1048576
+#define _DIRECT_SEGMENT_BLOCKS      16
+#define _DIRECT_ALIGN(_Size)        (((_Size) + _DIRECT_ALIGNMENT - 1) / _DIRECT_ALIGNMENT * _DIRECT_ALIGNMENT)
+
+struct _direct_sink_t {
+    FILE *file;
+    int fd;
+    int direct;                 /** 0 if the file system refused O_DIRECT **/
+    char *blocks[2];
+    size_t block_size;
+    int active;                 /** block being filled **/
+    size_t length;              /** bytes in the active block **/
+    uint64_t offset;            /** file offset of the active block **/
+    int flight;                 /** block being written by the writer, -1 if none **/
+    uint64_t flight_offset;
+    uint64_t segment;           /** bytes preallocated at once **/
+    uint64_t preallocated;
+    int stop;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t writer;
+};
+
+#if defined(__GLIBC__) && defined(__linux__)
+
+static void _direct_sink_pwrite(_direct_sink_t *sink, const char *data, size_t size, uint64_t offset) {
+    ssize_t n;
+    while (size > 0) {
+        n = pwrite(sink->fd, data, size, (off_t) offset);
+        if (n < 0 && EINTR == errno) {
+            continue;
+        }
+        if (n <= 0) {
+            fprintf(stderr, "Unable to write log file: %s\n", strerror(errno));
+            return;
+        }
+        data += n;
+        size -= (size_t) n;
+        offset += (uint64_t) n;
+    }
+}
+
+static void *_direct_sink_writer(void *cookie) {
+    _direct_sink_t *sink = cookie;
+    pthread_mutex_lock(&sink->mutex);
+    for (;;) {
+        while (sink->flight < 0 && !sink->stop) {
+            pthread_cond_wait(&sink->cond, &sink->mutex);
+        }
+        if (sink->flight < 0) {
+            break;
+        }
+        pthread_mutex_unlock(&sink->mutex);
+        _direct_sink_pwrite(sink, sink->blocks[sink->flight], sink->block_size, sink->flight_offset);
+        if (!sink->direct) {
+            /* keep the page cache clean anyway: dirty pages would be kept, write them back first */
+            sync_file_range(sink->fd, (off_t) sink->flight_offset, (off_t) sink->block_size,
+                            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            posix_fadvise(sink->fd, (off_t) sink->flight_offset, (off_t) sink->block_size, POSIX_FADV_DONTNEED);
+        }
+        pthread_mutex_lock(&sink->mutex);
+        sink->flight = -1;
+        pthread_cond_broadcast(&sink->cond);
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return NULL;
+}
+
+static void _direct_sink_preallocate(_direct_sink_t *sink, uint64_t end) {
+    while (end > sink->preallocated) {
+        /* best effort: not every file system supports it */
+        fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, (off_t) sink->preallocated, (off_t) sink->segment);
+        sink->preallocated += sink->segment;
+    }
+}
+
+/*
+ * Hands the full active block to the writer, waiting for the previous one to be written.
+ */
+static void _direct_sink_submit(_direct_sink_t *sink) {
+    _direct_sink_preallocate(sink, sink->offset + sink->block_size);
+    pthread_mutex_lock(&sink->mutex);
+    while (sink->flight >= 0) {
+        pthread_cond_wait(&sink->cond, &sink->mutex);
+    }
+    sink->flight = sink->active;
+    sink->flight_offset = sink->offset;
+    pthread_cond_broadcast(&sink->cond);
+    pthread_mutex_unlock(&sink->mutex);
+    sink->active ^= 1;
+    sink->offset += sink->block_size;
+    sink->length = 0;
+}
+
+static ssize_t _direct_sink_write(void *cookie, const char *data, size_t size) {
+    _direct_sink_t *sink = cookie;
+    size_t written = 0, n;
+    while (written < size) {
+        n = sink->block_size - sink->length;
+        n = (n < size - written) ? n : size - written;
+        memcpy(sink->blocks[sink->active] + sink->length, data + written, n);
+        sink->length += n;
+        written += n;
+        if (sink->length == sink->block_size) {
+            _direct_sink_submit(sink);
+        }
+    }
+    return (ssize_t) size;
+}
+
+/*
+ * Only reports the logical position in the file, which is what ftell() returns.
+ */
+static int _direct_sink_seek(void *cookie, off64_t *position, int whence) {
+    _direct_sink_t *sink = cookie;
+    if (0 != *position || SEEK_SET == whence) {
+        return -1;
+    }
+    *position = (off64_t) (sink->offset + sink->length);
+    return 0;
+}
+
+static int _direct_sink_close(void *cookie) {
+    _direct_sink_t *sink = cookie;
+    size_t padded = _DIRECT_ALIGN(sink->length);
+
+    pthread_mutex_lock(&sink->mutex);
+    sink->stop = 1;
+    pthread_cond_broadcast(&sink->cond);
+    pthread_mutex_unlock(&sink->mutex);
+    pthread_join(sink->writer, NULL);
+
+    /* the final partial block goes out padded to the alignment, then the padding is cut */
+    if (sink->length > 0) {
+        memset(sink->blocks[sink->active] + sink->length, 0, padded - sink->length);
+        _direct_sink_pwrite(sink, sink->blocks[sink->active], padded, sink->offset);
+    }
+    if (0 != ftruncate(sink->fd, (off_t) (sink->offset + sink->length))) {
+        fprintf(stderr, "Unable to truncate log file: %s\n", strerror(errno));
+    }
+    fclose(sink->file);
+    pthread_cond_destroy(&sink->cond);
+    pthread_mutex_destroy(&sink->mutex);
+    free(sink->blocks[0]);
+    free(sink->blocks[1]);
+    free(sink);
+    return 0;
+}
+
+static _direct_sink_t *_direct_sink_new(FILE *file, const char *file_path, size_t block_size, size_t segment) {
+    struct stat info;
+    int flags, tail;
+    _direct_sink_t *sink = malloc(sizeof(_direct_sink_t));
+    if (NULL == sink) {
+        abort();
+    }
+    fflush(file);
+    sink->file = file;
+    sink->fd = fileno(file);
+    sink->block_size = block_size;
+    if (0 != posix_memalign((void **) &sink->blocks[0], _DIRECT_ALIGNMENT, block_size) ||
+        0 != posix_memalign((void **) &sink->blocks[1], _DIRECT_ALIGNMENT, block_size)) {
+        abort();
+    }
+    sink->active = 0;
+    sink->flight = -1;
+    sink->flight_offset = 0;
+    sink->stop = 0;
+
+    /* blocks are written at explicit offsets: O_APPEND would ignore them */
+    flags = fcntl(sink->fd, F_GETFL);
+    sink->direct = (0 == fcntl(sink->fd, F_SETFL, (flags & ~O_APPEND) | O_DIRECT));
+    if (!sink->direct) {
+        fprintf(stderr, "O_DIRECT not supported for '%s', falling back to buffered writes\n", file_path);
+        fcntl(sink->fd, F_SETFL, flags & ~O_APPEND);
+    }
+
+    /* appending: the active block starts at the aligned offset below the end of file */
+    if (0 != fstat(sink->fd, &info)) {
+        fprintf(stderr, "Unable to stat file: '%s'\n", file_path);
+        abort();
+    }
+    sink->offset = (uint64_t) info.st_size / _DIRECT_ALIGNMENT * _DIRECT_ALIGNMENT;
+    sink->length = (size_t) ((uint64_t) info.st_size - sink->offset);
+    if (sink->length > 0) {
+        tail = open(file_path, O_RDONLY);
+        if (tail < 0 || pread(tail, sink->blocks[0], sink->length, (off_t) sink->offset) != (ssize_t) sink->length) {
+            fprintf(stderr, "Unable to read file: '%s'\n", file_path);
+            abort();
+        }
+        close(tail);
+    }
+
+    sink->segment = (segment > 0) ? _DIRECT_ALIGN(segment) : (uint64_t) block_size * _DIRECT_SEGMENT_BLOCKS;
+    sink->preallocated = sink->offset;
+    _direct_sink_preallocate(sink, sink->offset + 1);
+
+    if (0 != pthread_mutex_init(&sink->mutex, NULL) || 0 != pthread_cond_init(&sink->cond, NULL) ||
+        0 != pthread_create(&sink->writer, NULL, _direct_sink_writer, sink)) {
+        abort();
+    }
+    return sink;
+}
+
+static void _file_logger_attach_direct(logger_t *logger) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_direct && logger->_direct_block_size > 0);
+    cookie_io_functions_t functions;
+    _direct_sink_t *sink = _direct_sink_new(logger->_fd, logger->_file_path, logger->_direct_block_size,
+                                            logger->_policy_bytes);
+
+    functions.read = NULL;
+    functions.write = _direct_sink_write;
+    functions.seek = _direct_sink_seek;
+    functions.close = _direct_sink_close;
+    logger->_fd = fopencookie(sink, "w", functions);
+    if (NULL == logger->_fd) {
+        abort();
+    }
+    logger->_raw_fd = fileno(logger->_fd);
+    logger->_direct = sink;
+}
+
+#else
+
+/*
+ * Cookie streams are a glibc extension, O_DIRECT and fallocate(2) Linux ones:
+ * elsewhere the plain stdio stream is kept.
+ */
+static void _file_logger_attach_direct(logger_t *logger) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_direct && logger->_direct_block_size > 0);
+    fprintf(stderr, "Direct I/O not supported on this platform, falling back to buffered writes\n");
+    logger->_direct_block_size = 0;
+}
+
+#endif
+
+static size_t _policy_written_bytes(logger_t *logger) {
+    return (NULL != logger->_frame && LOG_THRESHOLD_STORED == logger->_threshold) ?
+           (size_t) logger->_frame->stored_bytes : logger->_written_bytes;
+}
 
 static void _file_logger_open_file(logger_t *logger, log_mode_t mode, const char *file_path) {
     assert(NULL != logger);
@@ -148,30 +867,59 @@ static void _file_logger_open_file(logger_t *logger, log_mode_t mode, const char
         fprintf(stderr, "Unable to open file: '%s'\n", file_path);
         abort();
     }
+    logger->_raw_fd = fileno(logger->_fd);
     logger->_file_path = _string_new(file_path);
     logger->_written_bytes = 0;
 }
 
 static void _file_logger_close_file(logger_t *logger) {
     assert(NULL != logger && _IS_FILE_LOGGER(logger));
-    fclose(logger->_fd);
+    FILE *fd = logger->_fd;
+    /* the crash handler must never see a stream being freed */
+    logger->_fd = NULL;
+    logger->_raw_fd = -1;
+    logger->_frame = NULL;
+    logger->_direct = NULL;
+    fclose(fd);
     free(logger->_file_path);
     logger->_written_bytes = 0;
 }
 
 static void _file_logger_sweep_file(logger_t *logger) {
     assert(NULL != logger && _IS_FILE_LOGGER(logger));
-    fclose(logger->_fd);
+    int indexed = _IS_INDEXED(logger);
+    FILE *fd = logger->_fd;
+    if (indexed) {
+        _index_close(logger);
+    }
+    logger->_fd = NULL;
+    logger->_raw_fd = -1;
+    logger->_frame = NULL;
+    logger->_direct = NULL;
+    fclose(fd);
     logger->_fd = fopen(logger->_file_path, _FILE_LOGGER_MODE(LOG_MODE_WRITE));
     if (NULL == logger->_fd) {
         fprintf(stderr, "Unable to open file: '%s'\n", logger->_file_path);
         abort();
     }
+    logger->_raw_fd = fileno(logger->_fd);
+    if (logger->_block_size > 0) {
+        _file_logger_attach_frame(logger);
+    } else if (logger->_direct_block_size > 0) {
+        _file_logger_attach_direct(logger);
+    }
     logger->_written_bytes = 0;
+    if (indexed) {
+        _index_open(logger);
+    }
 }
 
 static void _file_logger_rotate_file(logger_t *logger) {
     assert(NULL != logger && _IS_FILE_LOGGER(logger));
+    int indexed = _IS_INDEXED(logger);
+    if (indexed) {
+        _index_close(logger);
+    }
 
     char ext[128];
     int c = atoi(extname(logger->_file_path));
@@ -192,8 +940,17 @@ static void _file_logger_rotate_file(logger_t *logger) {
         fprintf(stderr, "Unable to open file: '%s'\n", logger->_file_path);
         abort();
     }
+    logger->_raw_fd = fileno(logger->_fd);
     logger->_file_path = tmp;
     logger->_written_bytes = 0;
+    if (logger->_block_size > 0) {
+        _file_logger_attach_frame(logger);
+    } else if (logger->_direct_block_size > 0) {
+        _file_logger_attach_direct(logger);
+    }
+    if (indexed) {
+        _index_open(logger);
+    }
 }
 
 static logger_t * _file_logger_new(const char *identifier, log_level_t level, const char *file_path, log_mode_t mode,
@@ -203,11 +960,8 @@ static logger_t * _file_logger_new(const char *identifier, log_level_t level, co
         return NULL;
     }
     _file_logger_open_file(logger, mode, file_path);
-    logger->_identifier = _string_new((NULL != identifier) ? identifier : "unknown");
-    logger->_level = (LOG_LEVEL_DEBUG == level && NDEBUG != 0) ? LOG_LEVEL_NOTICE : level;
-    logger->_policy = policy;
-    logger->_policy_bytes = bytes;
-    logger->_written_bytes = 0;
+    logger->_shm = NULL;
+    _logger_init(logger, identifier, level, policy, bytes);
     return logger;
 }
 
@@ -227,112 +981,800 @@ logger_t * buffer_logger_new(const char *identifier, log_level_t level, const ch
 }
 
 /*
- * Common logger destructor
- */
-void logger_delete(logger_t **logger) {
-    if (NULL != logger && NULL != *logger) {
-        if (_IS_FILE_LOGGER(*logger)) {
-            _file_logger_close_file(*logger);
-        }
-        free((*logger)->_identifier);
-        free(*logger);
-        *logger = NULL;
-    }
-}
-
-/*
- * Logging function internals
+ * Shared memory sink
+ *
+ * A stdio cookie stream pushing every flushed record into the shared ring,
+ * its buffer is large enough to hold a whole record.
  */
-static const char *_timestring(void) {
-    time_t rawtime;
-    struct tm *timeinfo;
-    time(&rawtime);
-    timeinfo = gmtime(&rawtime);
-    char *timestring = asctime(timeinfo);
-    size_t len = strlen(timestring);
-    timestring[len - 1] = '\0';
-    return timestring;
-}
+struct _shm_sink_t {
+    logger_shm_ring_t *ring;
+    logger_t *logger;
+};
 
-static void _log(logger_t *logger, log_level_t level, const char *format, va_list args) {
-    logger->_written_bytes += (logger->_fd == stdout || logger->_fd == stderr) ?
-            fprintf(logger->_fd, "%s%-7s [%s UTC]%s -- (%s): ", _level2color(level), _level2string(level), _timestring(), _COLOR_NORMAL, logger->_identifier)
-                                                                               :
-            fprintf(logger->_fd, "%-7s [%s UTC] -- (%s): ", _level2string(level), _timestring(), logger->_identifier)
-            ;
+#ifdef __GLIBC__
 
-    logger->_written_bytes += vfprintf(logger->_fd, format, args);
-    fflush(logger->_fd);
+static ssize_t _shm_sink_write(void *cookie, const char *data, size_t size) {
+    _shm_sink_t *sink = cookie;
+    size_t written = 0, n;
+    while (written < size) {
+        n = (size - written < LOGGER_SHM_MAX_RECORD) ? size - written : LOGGER_SHM_MAX_RECORD;
+        logger_shm_push(sink->ring, sink->logger->_record_level, sink->logger->_record_time,
+                        sink->logger->_record_sequence, data + written, n, NULL, 0);
+        written += n;
+    }
+    return (ssize_t) size;
 }
 
-/*
- * None Policy
- */
-static void _apply_none_policy(logger_t *logger, log_level_t level, const char *format, va_list args) {
-    assert(NULL != logger);
-    _log(logger, level, format, args);
+static int _shm_sink_close(void *cookie) {
+    _shm_sink_t *sink = cookie;
+    logger_shm_close(sink->ring);
+    free(sink);
+    return 0;
+}
+
+/*
+ * Shared memory logger constructor
+ */
+logger_t * shm_logger_new(const char *identifier, log_level_t level, const char *name) {
+    cookie_io_functions_t functions;
+    _shm_sink_t *sink;
+    logger_t *logger = malloc(sizeof(logger_t));
+    if (NULL == logger) {
+        return NULL;
+    }
+    sink = malloc(sizeof(_shm_sink_t));
+    if (NULL == sink) {
+        free(logger);
+        return NULL;
+    }
+    sink->ring = logger_shm_open(name);
+    if (NULL == sink->ring) {
+        fprintf(stderr, "Unable to open shared memory: '%s'\n", name);
+        abort();
+    }
+    sink->logger = logger;
+
+    functions.read = NULL;
+    functions.write = _shm_sink_write;
+    functions.seek = NULL;
+    functions.close = _shm_sink_close;
+    logger->_fd = fopencookie(sink, "w", functions);
+    if (NULL == logger->_fd) {
+        abort();
+    }
+    setvbuf(logger->_fd, NULL, _IOFBF, LOGGER_SHM_MAX_RECORD);
+    logger->_raw_fd = -1;
+    logger->_file_path = NULL;
+    logger->_shm = sink;
+    _logger_init(logger, identifier, level, _LOG_POLICY_NONE, 0);
+    return logger;
+}
+
+#else
+
+/*
+ * Shared memory logger constructor: cookie streams are a glibc extension.
+ */
+logger_t * shm_logger_new(const char *identifier, log_level_t level, const char *name) {
+    (void) identifier;
+    (void) level;
+    fprintf(stderr, "Shared memory loggers not supported on this platform: '%s'\n", name);
+    return NULL;
+}
+
+#endif
+
+/*
+ * Level getter
+ */
+log_level_t logger_get_level(const logger_t *logger) {
+    assert(NULL != logger);
+    return logger->_level;
+}
+
+/*
+ * Clock setter
+ */
+void logger_set_clock(logger_t *logger, log_clock_t clock) {
+    assert(NULL != logger);
+    if (LOG_CLOCK_TSC == clock && !_tsc_calibrate()) {
+        clock = LOG_CLOCK_REALTIME;
+    }
+    logger->_clock = clock;
+}
+
+/*
+ * Sidecar index
+ */
+void logger_enable_index(logger_t *logger, size_t records) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && records > 0);
+    if (_IS_INDEXED(logger)) {
+        _index_close(logger);
+    }
+    logger->_index_records = records;
+    _index_open(logger);
+}
+
+/*
+ * Compression
+ */
+void logger_enable_compression(logger_t *logger, log_compression_t compression, size_t block_size, log_threshold_t threshold) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_frame && NULL == logger->_direct);
+    int indexed = _IS_INDEXED(logger);
+    if (!logger_frame_codec_available((uint32_t) compression)) {
+        fprintf(stderr, "Compression codec %d not available, blocks will be stored uncompressed\n", (int) compression);
+        compression = LOG_COMPRESSION_NONE;
+    }
+    if (indexed) {
+        _index_close(logger);
+    }
+    logger->_compression = compression;
+    logger->_block_size = (block_size > 0) ? block_size : _FRAME_DEFAULT_BLOCK_SIZE;
+    logger->_threshold = threshold;
+    fflush(logger->_fd);
+    _file_logger_attach_frame(logger);
+    if (indexed) {
+        _index_open(logger);
+    }
+}
+
+/*
+ * Direct I/O
+ */
+void logger_enable_direct_io(logger_t *logger, size_t block_size) {
+    assert(NULL != logger && _IS_FILE_LOGGER(logger) && NULL == logger->_frame && NULL == logger->_direct);
+    int indexed = _IS_INDEXED(logger);
+    if (indexed) {
+        _index_close(logger);
+    }
+    logger->_direct_block_size = _DIRECT_ALIGN((block_size > 0) ? block_size : _DIRECT_DEFAULT_BLOCK_SIZE);
+    _file_logger_attach_direct(logger);
+    if (indexed) {
+        _index_open(logger);
+    }
+}
+
+/*
+ * Common logger destructor
+ */
+void logger_delete(logger_t **logger) {
+    if (NULL != logger && NULL != *logger) {
+        if (NULL != (*logger)->_staging) {
+            _staging_delete(*logger);
+        }
+        _logger_registry_remove(*logger);
+        if (_IS_INDEXED(*logger)) {
+            _index_close(*logger);
+        }
+        if (_IS_FILE_LOGGER(*logger)) {
+            _file_logger_close_file(*logger);
+        }
+        if (NULL != (*logger)->_shm) {
+            (*logger)->_shm = NULL;
+            fclose((*logger)->_fd);
+        }
+        free((*logger)->_identifier);
+        free(*logger);
+        *logger = NULL;
+    }
+}
+
+/*
+ * Logging function internals
+ */
+#define _TIMESTRING_SIZE    64
+
+/*
+ * Formats the timestamp like asctime() does with nanoseconds after the seconds,
+ * the broken-down time is cached per thread as it only changes once a second.
+ */
+static const char *_timestring(int64_t ns) {
+    static __thread char timestring[_TIMESTRING_SIZE];
+    static __thread char prefix[_TIMESTRING_SIZE];
+    static __thread char year[8];
+    static __thread time_t cached = -1;
+    time_t rawtime = (time_t) (ns / 1000000000);
+    struct tm timeinfo;
+
+    if (rawtime != cached) {
+        gmtime_r(&rawtime, &timeinfo);
+        strftime(prefix, sizeof(prefix), "%a %b %e %H:%M:%S", &timeinfo);
+        strftime(year, sizeof(year), "%Y", &timeinfo);
+        cached = rawtime;
+    }
+    snprintf(timestring, sizeof(timestring), "%s.%09ld %s", prefix, (long) (ns % 1000000000), year);
+    return timestring;
+}
+
+#define _LOG_HEADER_SIZE    512
+#define _LOG_WRITEV_BATCH   16
+
+static size_t _format_header(logger_t *logger, log_level_t level, int64_t now, uint64_t sequence, char *buffer, size_t size) {
+    int length = (logger->_fd == stdout || logger->_fd == stderr) ?
+            snprintf(buffer, size, "%s%-7s [%s UTC] #%lu%s -- (%s): ", _level2color(level), _level2string(level), _timestring(now), (unsigned long) sequence, _COLOR_NORMAL, logger->_identifier)
+                                                                  :
+            snprintf(buffer, size, "%-7s [%s UTC] #%lu -- (%s): ", _level2string(level), _timestring(now), (unsigned long) sequence, logger->_identifier)
+            ;
+    return (length < 0) ? 0 : ((size_t) length < size) ? (size_t) length : size - 1;
+}
+
+/*
+ * Sequence numbers are global to the process, or to the ring for shared memory loggers.
+ */
+static uint64_t _next_sequences(logger_t *logger, uint64_t count) {
+    return __atomic_fetch_add((NULL != logger->_shm) ? &logger->_shm->ring->sequence : &_sequence, count, __ATOMIC_RELAXED);
+}
+
+static uint64_t _next_sequence(logger_t *logger) {
+    return _next_sequences(logger, 1);
+}
+
+static void _log(logger_t *logger, log_level_t level, int64_t now, uint64_t sequence, const char *format, va_list args) {
+    char header[_LOG_HEADER_SIZE];
+    size_t bytes;
+
+    logger->_record_level = level;
+    logger->_record_time = now;
+    logger->_record_sequence = sequence;
+    if (_IS_INDEXED(logger)) {
+        _index_begin_record(logger);
+    }
+
+    bytes = fwrite(header, 1, _format_header(logger, level, now, sequence, header, sizeof(header)), logger->_fd);
+    bytes += vfprintf(logger->_fd, format, args);
+    fflush(logger->_fd);
+    logger->_written_bytes += bytes;
+
+    if (_IS_INDEXED(logger)) {
+        _index_end_record(logger, level, now, bytes);
+    }
+}
+
+/*
+ * Writes the whole batch handling short writes, returns the bytes written.
+ */
+static size_t _writev_all(int fd, struct iovec *iov, int iovcnt) {
+    size_t total = 0, consumed;
+    ssize_t n;
+    while (iovcnt > 0) {
+        n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            break;
+        }
+        total += (size_t) n;
+        consumed = (size_t) n;
+        while (iovcnt > 0 && consumed >= iov->iov_len) {
+            consumed -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + consumed;
+            iov->iov_len -= consumed;
+        }
+    }
+    return total;
+}
+
+/*
+ * Hands the header (if any) and the payload to the descriptor backing the stream
+ * with writev(2), streams without a descriptor (e.g. cookie streams) go through stdio.
+ */
+static void _write_record(logger_t *logger, log_level_t level, int64_t now, uint64_t sequence,
+                          const struct iovec *header, const struct iovec *iov, int iovcnt) {
+    struct iovec batch[_LOG_WRITEV_BATCH];
+    size_t bytes = 0;
+    int i, n = 0;
+
+    logger->_record_level = level;
+    logger->_record_time = now;
+    logger->_record_sequence = sequence;
+    if (_IS_INDEXED(logger)) {
+        _index_begin_record(logger);
+    }
+
+    if (logger->_raw_fd < 0) {
+        if (NULL != header) {
+            bytes += fwrite(header->iov_base, 1, header->iov_len, logger->_fd);
+        }
+        for (i = 0; i < iovcnt; i++) {
+            bytes += fwrite(iov[i].iov_base, 1, iov[i].iov_len, logger->_fd);
+        }
+        fflush(logger->_fd);
+    } else {
+        /* keep ordering with anything still sitting in the stdio buffer */
+        fflush(logger->_fd);
+        if (NULL != header) {
+            batch[n++] = *header;
+        }
+        for (i = 0; i < iovcnt; i++) {
+            batch[n++] = iov[i];
+            if (_LOG_WRITEV_BATCH == n) {
+                bytes += _writev_all(logger->_raw_fd, batch, n);
+                n = 0;
+            }
+        }
+        if (n > 0) {
+            bytes += _writev_all(logger->_raw_fd, batch, n);
+        }
+    }
+    logger->_written_bytes += bytes;
+
+    if (_IS_INDEXED(logger)) {
+        _index_end_record(logger, level, now, bytes);
+    }
+}
+
+static void _log_raw(logger_t *logger, log_level_t level, int64_t now, uint64_t sequence,
+                     const struct iovec *iov, int iovcnt) {
+    char buffer[_LOG_HEADER_SIZE];
+    struct iovec header;
+
+    header.iov_base = buffer;
+    header.iov_len = _format_header(logger, level, now, sequence, buffer, sizeof(buffer));
+    _write_record(logger, level, now, sequence, &header, iov, iovcnt);
+}
+
+/*
+ * None Policy
+ */
+static void _apply_none_policy(logger_t *logger) {
+    assert(NULL != logger);
 }
 
 /*
  * Rotate Policy
  */
-static void _apply_rotate_policy(logger_t *logger, log_level_t level, const char *format, va_list args) {
+static void _apply_rotate_policy(logger_t *logger) {
     assert(NULL != logger && _IS_FILE_LOGGER(logger));
 
-    if (logger->_written_bytes >= logger->_policy_bytes) {
+    if (_policy_written_bytes(logger) >= logger->_policy_bytes) {
         _file_logger_rotate_file(logger);
     }
-
-    _log(logger, level, format, args);
 }
 
 /*
  * Overwrite Policy
  */
-static void _apply_buffer_policy(logger_t *logger, log_level_t level, const char *format, va_list args) {
+static void _apply_buffer_policy(logger_t *logger) {
     assert(NULL != logger && _IS_FILE_LOGGER(logger));
 
-    if (logger->_written_bytes >= logger->_policy_bytes) {
+    if (_policy_written_bytes(logger) >= logger->_policy_bytes) {
         _file_logger_sweep_file(logger);
     }
-
-    _log(logger, level, format, args);
 }
 
 /*
- * Logging functions entry point
+ * Logging functions entry point: applies the policy before a record is written.
+ * the level is checked and the record stamped by the callers beforehand, so that
+ * a rotation does not end up in the timestamp.
  */
-static void _apply_policy(logger_t *logger, log_level_t level, const char *format, va_list args) {
+static void _apply_policy(logger_t *logger) {
     assert(NULL != logger);
 
-    if (level < logger->_level) {
-        return;
-    }
-
     switch (logger->_policy) {
         case _LOG_POLICY_NONE:
-            _apply_none_policy(logger, level, format, args);
+            _apply_none_policy(logger);
             break;
         case _LOG_POLICY_ROTATE:
-            _apply_rotate_policy(logger, level, format, args);
+            _apply_rotate_policy(logger);
             break;
         case _LOG_POLICY_BUFFER:
-            _apply_buffer_policy(logger, level, format, args);
+            _apply_buffer_policy(logger);
             break;
         default:
             abort();
     }
 }
 
+/*
+ * Staging buffers
+ *
+ * Each thread formats its records into its own cache-line aligned buffer guarded
+ * by its own (uncontended) mutex, stamping them while holding it. A flush locks
+ * every buffer at once and swaps it with its spare, so that no record stamped
+ * before the swap can show up after it, then k-way merges the spares by timestamp
+ * into the sink applying the policy record by record. Sequence numbers are given
+ * at flush time, in the merged order.
+ */
+#define _STAGING_CACHE_LINE         64
+#define _STAGING_ALIGN(_Size)       (((_Size) + 7) / 8 * 8)
+#define _STAGING_RECORD_SIZE(_Length)   (sizeof(_staged_record_t) + _STAGING_ALIGN(_Length))
+
+/* set by the crash handler, which drains what flushes have not written yet */
+static int _staging_crashing = 0;
+
+typedef struct _staged_record_t {
+    int64_t timestamp;
+    uint32_t length;            /** payload bytes following the record **/
+    uint32_t level;
+} _staged_record_t;
+
+typedef struct _staging_buffer_t {
+    pthread_mutex_t mutex;
+    char *records;              /** records staged since the last flush **/
+    size_t length;
+    char *spare;                /** records being merged by the flusher **/
+    size_t spare_length;
+    size_t cursor;              /** merge position in spare **/
+    size_t crash_cursor;        /** merge position in spare or records, for the crash handler **/
+    int detached;               /** the owner thread exited **/
+    struct _staging_buffer_t *next;
+} __attribute__((aligned(_STAGING_CACHE_LINE))) _staging_buffer_t;
+
+struct _staging_t {
+    size_t bytes;
+    pthread_key_t key;
+    pthread_mutex_t mutex;      /** serializes flushes and guards the buffers list **/
+    _staging_buffer_t *buffers;
+    unsigned int interval_ms;
+    int stop;
+    pthread_cond_t cond;
+    pthread_t flusher;
+};
+
+static void _staging_detach(void *cookie) {
+    _staging_buffer_t *buffer = cookie;
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->detached = 1;
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+static void _staging_buffer_delete(_staging_buffer_t *buffer) {
+    pthread_mutex_destroy(&buffer->mutex);
+    free(buffer->records);
+    free(buffer->spare);
+    free(buffer);
+}
+
+static _staging_buffer_t *_staging_buffer(logger_t *logger) {
+    _staging_t *staging = logger->_staging;
+    _staging_buffer_t *buffer = pthread_getspecific(staging->key);
+    if (NULL != buffer) {
+        return buffer;
+    }
+    if (0 != posix_memalign((void **) &buffer, _STAGING_CACHE_LINE, sizeof(_staging_buffer_t)) ||
+        0 != posix_memalign((void **) &buffer->records, _STAGING_CACHE_LINE, staging->bytes) ||
+        0 != posix_memalign((void **) &buffer->spare, _STAGING_CACHE_LINE, staging->bytes) ||
+        0 != pthread_mutex_init(&buffer->mutex, NULL)) {
+        abort();
+    }
+    buffer->length = 0;
+    buffer->spare_length = 0;
+    buffer->cursor = 0;
+    buffer->crash_cursor = 0;
+    buffer->detached = 0;
+    pthread_setspecific(staging->key, buffer);
+
+    pthread_mutex_lock(&staging->mutex);
+    buffer->next = staging->buffers;
+    staging->buffers = buffer;
+    pthread_mutex_unlock(&staging->mutex);
+    return buffer;
+}
+
+static void _staging_sift_down(_staging_buffer_t **heap, size_t size, size_t i) {
+    _staging_buffer_t *tmp;
+    size_t child;
+    while ((child = 2 * i + 1) < size) {
+        if (child + 1 < size && ((_staged_record_t *) (heap[child + 1]->spare + heap[child + 1]->cursor))->timestamp <
+                                ((_staged_record_t *) (heap[child]->spare + heap[child]->cursor))->timestamp) {
+            child++;
+        }
+        if (((_staged_record_t *) (heap[i]->spare + heap[i]->cursor))->timestamp <=
+            ((_staged_record_t *) (heap[child]->spare + heap[child]->cursor))->timestamp) {
+            return;
+        }
+        tmp = heap[i];
+        heap[i] = heap[child];
+        heap[child] = tmp;
+        i = child;
+    }
+}
+
+/*
+ * A flush running while the crash handler drains its records stops for good.
+ */
+static void _staging_check_crash(void) {
+    if (__atomic_load_n(&_staging_crashing, __ATOMIC_ACQUIRE)) {
+        for (;;) {
+            pause();
+        }
+    }
+}
+
+static void _staging_write(logger_t *logger, const _staged_record_t *record) {
+    char header[_LOG_HEADER_SIZE];
+    log_level_t level = (log_level_t) record->level;
+    uint64_t sequence;
+    size_t bytes;
+
+    if (level < logger->_level) {
+        return;
+    }
+    _apply_policy(logger);
+    sequence = _next_sequence(logger);
+    logger->_record_level = level;
+    logger->_record_time = record->timestamp;
+    logger->_record_sequence = sequence;
+    if (_IS_INDEXED(logger)) {
+        _index_begin_record(logger);
+    }
+
+    bytes = fwrite(header, 1, _format_header(logger, level, record->timestamp, sequence, header, sizeof(header)), logger->_fd);
+    bytes += fwrite(record + 1, 1, record->length, logger->_fd);
+    if (NULL != logger->_shm) {
+        /* the shared memory sink takes one record per flush */
+        fflush(logger->_fd);
+    }
+    logger->_written_bytes += bytes;
+
+    if (_IS_INDEXED(logger)) {
+        _index_end_record(logger, level, record->timestamp, bytes);
+    }
+}
+
+/*
+ * To be called holding the staging mutex.
+ */
+static void _staging_flush(logger_t *logger) {
+    _staging_t *staging = logger->_staging;
+    _staging_buffer_t *buffer, **heap, **link;
+    const _staged_record_t *record;
+    size_t count = 0, size = 0, i;
+    char *tmp;
+
+    for (buffer = staging->buffers; NULL != buffer; buffer = buffer->next) {
+        pthread_mutex_lock(&buffer->mutex);
+        count++;
+    }
+    for (buffer = staging->buffers; NULL != buffer; buffer = buffer->next) {
+        tmp = buffer->spare;
+        buffer->spare = buffer->records;
+        buffer->spare_length = buffer->length;
+        buffer->records = tmp;
+        buffer->length = 0;
+        buffer->cursor = 0;
+    }
+    for (buffer = staging->buffers; NULL != buffer; buffer = buffer->next) {
+        pthread_mutex_unlock(&buffer->mutex);
+    }
+
+    heap = malloc((count > 0 ? count : 1) * sizeof(_staging_buffer_t *));
+    if (NULL == heap) {
+        abort();
+    }
+    for (buffer = staging->buffers; NULL != buffer; buffer = buffer->next) {
+        if (buffer->spare_length > 0) {
+            heap[size++] = buffer;
+        }
+    }
+    for (i = size; i > 0; i--) {
+        _staging_sift_down(heap, size, i - 1);
+    }
+    while (size > 0) {
+        _staging_check_crash();
+        record = (const _staged_record_t *) (heap[0]->spare + heap[0]->cursor);
+        _staging_write(logger, record);
+        heap[0]->cursor += _STAGING_RECORD_SIZE(record->length);
+        if (heap[0]->cursor >= heap[0]->spare_length) {
+            heap[0]->spare_length = 0;
+            heap[0] = heap[--size];
+        }
+        _staging_sift_down(heap, size, 0);
+    }
+    free(heap);
+    _staging_check_crash();
+    fflush(logger->_fd);
+
+    /* exited threads may have staged records after the swap: their buffers go once empty */
+    link = &staging->buffers;
+    while (NULL != (buffer = *link)) {
+        pthread_mutex_lock(&buffer->mutex);
+        if (buffer->detached && 0 == buffer->length) {
+            *link = buffer->next;
+            pthread_mutex_unlock(&buffer->mutex);
+            _staging_buffer_delete(buffer);
+        } else {
+            pthread_mutex_unlock(&buffer->mutex);
+            link = &buffer->next;
+        }
+    }
+}
+
+static void *_staging_flusher(void *cookie) {
+    logger_t *logger = cookie;
+    _staging_t *staging = logger->_staging;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&staging->mutex);
+    while (!staging->stop) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += staging->interval_ms / 1000;
+        deadline.tv_nsec += (long) (staging->interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&staging->cond, &staging->mutex, &deadline);
+        _staging_flush(logger);
+    }
+    pthread_mutex_unlock(&staging->mutex);
+    return NULL;
+}
+
+static void _staging_delete(logger_t *logger) {
+    _staging_t *staging = logger->_staging;
+    _staging_buffer_t *buffer;
+
+    if (staging->interval_ms > 0) {
+        pthread_mutex_lock(&staging->mutex);
+        staging->stop = 1;
+        pthread_cond_broadcast(&staging->cond);
+        pthread_mutex_unlock(&staging->mutex);
+        pthread_join(staging->flusher, NULL);
+    }
+    pthread_mutex_lock(&staging->mutex);
+    _staging_flush(logger);
+    pthread_mutex_unlock(&staging->mutex);
+
+    logger->_staging = NULL;
+    pthread_key_delete(staging->key);
+    while (NULL != (buffer = staging->buffers)) {
+        staging->buffers = buffer->next;
+        _staging_buffer_delete(buffer);
+    }
+    pthread_cond_destroy(&staging->cond);
+    pthread_mutex_destroy(&staging->mutex);
+    free(staging);
+}
+
+/*
+ * Stages a record in the buffer of the calling thread, formatting it (format != NULL)
+ * with *args or gathering iov. Returns 0 if it does not fit in the room left.
+ */
+static int _stage_record(logger_t *logger, log_level_t level, const char *format, va_list *args,
+                         const struct iovec *iov, int iovcnt) {
+    _staging_buffer_t *buffer = _staging_buffer(logger);
+    _staged_record_t *record;
+    size_t available, length = 0;
+    char *payload;
+    va_list copy;
+    int i, n;
+
+    pthread_mutex_lock(&buffer->mutex);
+    available = logger->_staging->bytes - buffer->length;
+    if (available <= sizeof(_staged_record_t)) {
+        pthread_mutex_unlock(&buffer->mutex);
+        return 0;
+    }
+    available -= sizeof(_staged_record_t);
+    record = (_staged_record_t *) (buffer->records + buffer->length);
+    payload = (char *) (record + 1);
+
+    if (NULL != format) {
+        __va_copy(copy, *args);
+        n = vsnprintf(payload, available, format, copy);
+        va_end(copy);
+        length = (n < 0) ? 0 : (size_t) n;
+        if ((size_t) n >= available) {
+            pthread_mutex_unlock(&buffer->mutex);
+            return 0;
+        }
+    } else {
+        for (i = 0; i < iovcnt; i++) {
+            length += iov[i].iov_len;
+        }
+        if (_STAGING_ALIGN(length) > available) {
+            pthread_mutex_unlock(&buffer->mutex);
+            return 0;
+        }
+        for (i = 0; i < iovcnt; i++) {
+            memcpy(payload, iov[i].iov_base, iov[i].iov_len);
+            payload += iov[i].iov_len;
+        }
+    }
+
+    record->timestamp = _clock_now(logger);
+    record->length = (uint32_t) length;
+    record->level = (uint32_t) level;
+    buffer->length += _STAGING_RECORD_SIZE(length);
+    pthread_mutex_unlock(&buffer->mutex);
+    return 1;
+}
+
+static void _stage(logger_t *logger, log_level_t level, const char *format, va_list *args,
+                   const struct iovec *iov, int iovcnt) {
+    _staging_t *staging = logger->_staging;
+    int64_t now;
+    va_list copy;
+
+    if (_stage_record(logger, level, format, args, iov, iovcnt)) {
+        return;
+    }
+    logger_flush(logger);
+    if (_stage_record(logger, level, format, args, iov, iovcnt)) {
+        return;
+    }
+
+    /* larger than a whole buffer: written through, after everything staged so far */
+    pthread_mutex_lock(&staging->mutex);
+    _staging_flush(logger);
+    now = _clock_now(logger);
+    _apply_policy(logger);
+    if (NULL != format) {
+        __va_copy(copy, *args);
+        _log(logger, level, now, _next_sequence(logger), format, copy);
+        va_end(copy);
+    } else {
+        _log_raw(logger, level, now, _next_sequence(logger), iov, iovcnt);
+    }
+    pthread_mutex_unlock(&staging->mutex);
+}
+
+/*
+ * Staging
+ */
+void logger_enable_staging(logger_t *logger, size_t bytes, unsigned int interval_ms) {
+    assert(NULL != logger && NULL == logger->_staging && bytes > 0);
+    _staging_t *staging = malloc(sizeof(_staging_t));
+    if (NULL == staging) {
+        abort();
+    }
+    staging->bytes = (bytes + _STAGING_CACHE_LINE - 1) / _STAGING_CACHE_LINE * _STAGING_CACHE_LINE;
+    staging->buffers = NULL;
+    staging->interval_ms = interval_ms;
+    staging->stop = 0;
+    if (0 != pthread_key_create(&staging->key, _staging_detach) ||
+        0 != pthread_mutex_init(&staging->mutex, NULL) || 0 != pthread_cond_init(&staging->cond, NULL)) {
+        abort();
+    }
+    logger->_staging = staging;
+    if (interval_ms > 0 && 0 != pthread_create(&staging->flusher, NULL, _staging_flusher, logger)) {
+        abort();
+    }
+}
+
+/*
+ * Flush
+ */
+void logger_flush(logger_t *logger) {
+    assert(NULL != logger);
+    if (NULL != logger->_staging) {
+        pthread_mutex_lock(&logger->_staging->mutex);
+        _staging_flush(logger);
+        pthread_mutex_unlock(&logger->_staging->mutex);
+    } else {
+        fflush(logger->_fd);
+    }
+}
+
 /*
  * Define public logging functions
  */
-#define DEFINE_LOGGER(_Identifier, _Level)                              \
-    void log_##_Identifier(logger_t *logger, const char *format, ...) { \
-        va_list args;                                                   \
-        va_start(args, format);                                         \
-        _apply_policy(logger, LOG_LEVEL_##_Level, format, args);        \
-        va_end(args);                                                   \
+#define DEFINE_LOGGER(_Identifier, _Level)                                              \
+    void log_##_Identifier(logger_t *logger, const char *format, ...) {                 \
+        va_list args;                                                                   \
+        int64_t now;                                                                    \
+        uint64_t sequence;                                                              \
+        if (LOG_LEVEL_##_Level < logger->_level) {                                      \
+            return;                                                                     \
+        }                                                                               \
+        if (NULL != logger->_staging) {                                                 \
+            va_start(args, format);                                                     \
+            _stage(logger, LOG_LEVEL_##_Level, format, &args, NULL, 0);                 \
+            va_end(args);                                                               \
+        } else {                                                                        \
+            now = _clock_now(logger);                                                   \
+            _apply_policy(logger);                                                      \
+            sequence = _next_sequence(logger);                                          \
+            va_start(args, format);                                                     \
+            _log(logger, LOG_LEVEL_##_Level, now, sequence, format, args);              \
+            va_end(args);                                                               \
+        }                                                                               \
     }
 
 DEFINE_LOGGER(debug, DEBUG)
@@ -343,3 +1785,539 @@ DEFINE_LOGGER(error, ERROR)
 DEFINE_LOGGER(fatal, FATAL)
 
 #undef DEFINE_LOGGER
+
+/*
+ * Raw logging functions
+ */
+void log_write(logger_t *logger, log_level_t level, const void *data, size_t length) {
+    struct iovec iov;
+    iov.iov_base = (void *) data;
+    iov.iov_len = length;
+    log_writev(logger, level, &iov, 1);
+}
+
+void log_writev(logger_t *logger, log_level_t level, const struct iovec *iov, int iovcnt) {
+    assert(NULL != iov || 0 == iovcnt);
+    int64_t now;
+    if (level < logger->_level) {
+        return;
+    }
+    if (NULL != logger->_staging) {
+        _stage(logger, level, NULL, NULL, iov, iovcnt);
+    } else {
+        now = _clock_now(logger);
+        _apply_policy(logger);
+        _log_raw(logger, level, now, _next_sequence(logger), iov, iovcnt);
+    }
+}
+
+/*
+ * Shared memory collector
+ */
+#define _SHM_STALL_SECONDS  2
+
+struct shm_collector_t {
+    logger_shm_ring_t *ring;
+    char *buffer;
+    uint64_t dropped;
+    time_t stalled_since;   /** when the ring got stuck on an unclaimed record, 0 if it is not **/
+    uint64_t stalled_tail;  /** tail of the ring when it got stuck **/
+};
+
+shm_collector_t * shm_collector_new(const char *name) {
+    shm_collector_t *collector = malloc(sizeof(shm_collector_t));
+    if (NULL == collector) {
+        return NULL;
+    }
+    collector->ring = logger_shm_open(name);
+    if (NULL == collector->ring) {
+        fprintf(stderr, "Unable to open shared memory: '%s'\n", name);
+        abort();
+    }
+    collector->buffer = malloc(LOGGER_SHM_MAX_RECORD);
+    if (NULL == collector->buffer) {
+        abort();
+    }
+    collector->dropped = __atomic_load_n(&collector->ring->dropped, __ATOMIC_RELAXED);
+    collector->stalled_since = 0;
+    collector->stalled_tail = 0;
+    return collector;
+}
+
+size_t shm_collector_drain(shm_collector_t *collector, logger_t *sink) {
+    assert(NULL != collector && NULL != sink);
+    size_t records = 0;
+    struct iovec iov;
+    int64_t timestamp;
+    uint64_t dropped, sequence;
+    int level;
+
+    do {
+        while ((iov.iov_len = logger_shm_pop(collector->ring, collector->buffer, &level, &timestamp, &sequence)) > 0) {
+            if (level >= (int) sink->_level) {
+                _apply_policy(sink);
+                iov.iov_base = collector->buffer;
+                _write_record(sink, (log_level_t) level, timestamp, sequence, NULL, &iov, 1);
+            }
+            records++;
+        }
+        /* a producer which died between claiming and publishing a record would block the ring forever */
+    } while (logger_shm_reap(collector->ring));
+
+    /* as would one dying right after reserving it, without a pid to check: give it some time */
+    if (records > 0 || !logger_shm_unclaimed(collector->ring)) {
+        collector->stalled_since = 0;
+    } else if (0 == collector->stalled_since) {
+        collector->stalled_since = time(NULL);
+        collector->stalled_tail = __atomic_load_n(&collector->ring->tail, __ATOMIC_ACQUIRE);
+    } else if (time(NULL) - collector->stalled_since >= _SHM_STALL_SECONDS) {
+        /* reservations made since are fresh, their producers may well be alive */
+        logger_shm_skip(collector->ring, collector->stalled_tail);
+        collector->stalled_since = 0;
+    }
+
+    dropped = __atomic_load_n(&collector->ring->dropped, __ATOMIC_RELAXED);
+    if (dropped != collector->dropped) {
+        log_warning(sink, "%lu records dropped: shared memory ring full or producer died\n", (unsigned long) (dropped - collector->dropped));
+        collector->dropped = dropped;
+    }
+    return records;
+}
+
+void shm_collector_delete(shm_collector_t **collector) {
+    if (NULL != collector && NULL != *collector) {
+        logger_shm_close((*collector)->ring);
+        free((*collector)->buffer);
+        free(*collector);
+        *collector = NULL;
+    }
+}
+
+/*
+ * Crash handler internals
+ *
+ * Everything below runs in signal context: only async-signal-safe calls,
+ * no locks, no allocations and no stdio.
+ */
+#define _CRASH_RECORD_SIZE  512
+#define _CRASH_STACK_SIZE   65536
+
+static const int _crash_signals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+static char _crash_stack[_CRASH_STACK_SIZE];
+static pthread_key_t _crash_stack_key;
+static pthread_once_t _crash_stack_once = PTHREAD_ONCE_INIT;
+
+static void _crash_write(int fd, const char *data, size_t length) {
+    ssize_t n;
+    while (length > 0) {
+        n = write(fd, data, length);
+        if (n <= 0) {
+            return;
+        }
+        data += n;
+        length -= (size_t) n;
+    }
+}
+
+static size_t _crash_append(char *buffer, size_t length, const char *str) {
+    while ('\0' != *str && length < _CRASH_RECORD_SIZE - 1) {
+        buffer[length++] = *str++;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+static size_t _crash_append_number(char *buffer, size_t length, long number, int width, char pad) {
+    char digits[32];
+    int n = 0;
+    unsigned long value = (number < 0) ? (unsigned long) -number : (unsigned long) number;
+    do {
+        digits[n++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0 && n < (int) sizeof(digits) - 1);
+    if (number < 0) {
+        digits[n++] = '-';
+    }
+    while (n < width && n < (int) sizeof(digits)) {
+        digits[n++] = pad;
+    }
+    while (n > 0 && length < _CRASH_RECORD_SIZE - 1) {
+        buffer[length++] = digits[--n];
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+/*
+ * Formats the current time the same way asctime() does; gmtime() is not
+ * async-signal-safe so the civil date is computed by hand.
+ */
+static size_t _crash_append_time(char *buffer, size_t length, const struct timespec *now) {
+    static const char *days[] = {"Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed"};
+    static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                   "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    long z, era, doe, yoe, doy, mp, d, m, y, secs;
+
+    z = (long) (now->tv_sec / 86400);
+    secs = (long) (now->tv_sec % 86400);
+
+    length = _crash_append(buffer, length, days[z % 7]);
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    doe = z - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2 ? 1 : 0);
+
+    length = _crash_append(buffer, length, " ");
+    length = _crash_append(buffer, length, months[m - 1]);
+    length = _crash_append(buffer, length, " ");
+    length = _crash_append_number(buffer, length, d, 2, ' ');
+    length = _crash_append(buffer, length, " ");
+    length = _crash_append_number(buffer, length, secs / 3600, 2, '0');
+    length = _crash_append(buffer, length, ":");
+    length = _crash_append_number(buffer, length, secs / 60 % 60, 2, '0');
+    length = _crash_append(buffer, length, ":");
+    length = _crash_append_number(buffer, length, secs % 60, 2, '0');
+    length = _crash_append(buffer, length, ".");
+    length = _crash_append_number(buffer, length, now->tv_nsec, 9, '0');
+    length = _crash_append(buffer, length, " ");
+    return _crash_append_number(buffer, length, y, 0, ' ');
+}
+
+/*
+ * Returns the bytes still sitting in the stdio buffer of the logger, if any:
+ * they are the beginning of the record being written when the signal hit.
+ */
+static const char *_crash_pending(logger_t *logger, size_t *length) {
+#ifdef __GLIBC__
+    FILE *fd = logger->_fd;
+    if (NULL != fd && fd->_IO_write_ptr > fd->_IO_write_base) {
+        *length = (size_t) (fd->_IO_write_ptr - fd->_IO_write_base);
+        return fd->_IO_write_base;
+    }
+#else
+    (void) logger;
+#endif
+    *length = 0;
+    return NULL;
+}
+
+static size_t _crash_format_header(logger_t *logger, log_level_t level, int64_t ns, uint64_t sequence,
+                                   char *record, size_t length) {
+    const char *name = _level2string(level);
+    int colored = (logger->_fd == stdout || logger->_fd == stderr);
+    struct timespec now;
+    size_t i;
+
+    now.tv_sec = (time_t) (ns / 1000000000);
+    now.tv_nsec = (long) (ns % 1000000000);
+    if (colored) {
+        length = _crash_append(record, length, _level2color(level));
+    }
+    length = _crash_append(record, length, name);
+    for (i = strlen(name); i < 7; i++) {
+        length = _crash_append(record, length, " ");
+    }
+    length = _crash_append(record, length, " [");
+    length = _crash_append_time(record, length, &now);
+    length = _crash_append(record, length, " UTC] #");
+    length = _crash_append_number(record, length, (long) sequence, 0, ' ');
+    if (colored) {
+        length = _crash_append(record, length, _COLOR_NORMAL);
+    }
+    length = _crash_append(record, length, " -- (");
+    length = _crash_append(record, length, logger->_identifier);
+    return _crash_append(record, length, "): ");
+}
+
+static size_t _crash_format_fatal(logger_t *logger, int signum, int64_t now, uint64_t sequence, char *record) {
+    size_t length = _crash_format_header(logger, LOG_LEVEL_FATAL, now, sequence, record, 0);
+    length = _crash_append(record, length, "Caught signal ");
+    length = _crash_append_number(record, length, signum, 0, ' ');
+    return _crash_append(record, length, "\n");
+}
+
+/*
+ * Where drained bytes go: `fd` written sequentially or, when `offset` is not
+ * negative, from that offset on. With a negative `fd` bytes are only counted.
+ */
+typedef struct _crash_output_t {
+    int fd;
+    off_t offset;
+    size_t length;      /** bytes emitted so far **/
+} _crash_output_t;
+
+static void _crash_emit(_crash_output_t *output, const char *data, size_t length) {
+    if (output->fd >= 0 && output->offset >= 0) {
+        pwrite(output->fd, data, length, output->offset + (off_t) output->length);
+    } else if (output->fd >= 0) {
+        _crash_write(output->fd, data, length);
+    }
+    output->length += length;
+}
+
+/*
+ * Starts a merge over the records a flush in progress has not written yet (`spare`)
+ * or over the records staged since the last flush.
+ */
+static void _crash_staged_rewind(logger_t *logger, int spare) {
+    _staging_buffer_t *buffer;
+    for (buffer = logger->_staging->buffers; NULL != buffer; buffer = buffer->next) {
+        buffer->crash_cursor = spare ? buffer->cursor : 0;
+    }
+}
+
+static const _staged_record_t *_crash_staged_next(logger_t *logger, int spare) {
+    const _staged_record_t *record = NULL, *candidate;
+    _staging_buffer_t *buffer, *next = NULL;
+    for (buffer = logger->_staging->buffers; NULL != buffer; buffer = buffer->next) {
+        if (buffer->crash_cursor < (spare ? buffer->spare_length : buffer->length)) {
+            candidate = (const _staged_record_t *) ((spare ? buffer->spare : buffer->records) + buffer->crash_cursor);
+            if (NULL == record || candidate->timestamp < record->timestamp) {
+                record = candidate;
+                next = buffer;
+            }
+        }
+    }
+    if (NULL != next) {
+        next->crash_cursor += _STAGING_RECORD_SIZE(record->length);
+    }
+    return record;
+}
+
+static size_t _crash_staged_count(logger_t *logger) {
+    size_t count = 0;
+    int spare;
+    if (NULL == logger->_staging) {
+        return 0;
+    }
+    for (spare = 1; spare >= 0; spare--) {
+        _crash_staged_rewind(logger, spare);
+        while (NULL != _crash_staged_next(logger, spare)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Drains the staged records not written yet merged by timestamp, those of a flush in
+ * progress first, numbered from `sequence` on, into `output` or into the ring for
+ * shared memory loggers.
+ */
+static void _crash_drain_staging(logger_t *logger, _crash_output_t *output, uint64_t sequence) {
+    char header[_CRASH_RECORD_SIZE];
+    const _staged_record_t *record;
+    size_t length;
+    int spare;
+
+    if (NULL == logger->_staging) {
+        return;
+    }
+    for (spare = 1; spare >= 0; spare--) {
+        _crash_staged_rewind(logger, spare);
+        while (NULL != (record = _crash_staged_next(logger, spare))) {
+            length = _crash_format_header(logger, (log_level_t) record->level, record->timestamp, sequence, header, 0);
+            if (NULL != logger->_shm) {
+                logger_shm_push(logger->_shm->ring, (int) record->level, record->timestamp, sequence,
+                                header, length, (const char *) (record + 1), record->length);
+            } else {
+                _crash_emit(output, header, length);
+                _crash_emit(output, (const char *) (record + 1), record->length);
+            }
+            sequence++;
+        }
+    }
+}
+
+/*
+ * The pending stdio bytes (terminated if they end with a truncated record), the
+ * staged records and the FATAL record, in this order.
+ */
+static void _crash_drain_records(logger_t *logger, _crash_output_t *output, const char *pending, size_t pending_length,
+                                 uint64_t sequence, const char *record, size_t record_length) {
+    _crash_emit(output, pending, pending_length);
+    if (pending_length > 0 && '\n' != pending[pending_length - 1]) {
+        _crash_emit(output, "\n", 1);
+    }
+    _crash_drain_staging(logger, output, sequence);
+    _crash_emit(output, record, record_length);
+}
+
+/*
+ * Compressed sinks get the pending block and the drained records as a single
+ * uncompressed block, whose length is counted first.
+ */
+static void _crash_drain_frame(logger_t *logger, _frame_sink_t *sink, const char *pending, size_t pending_length,
+                               uint64_t sequence, const char *record, size_t record_length) {
+    logger_frame_block_t block;
+    _crash_output_t output;
+
+    output.fd = -1;
+    output.offset = -1;
+    output.length = 0;
+    _crash_drain_records(logger, &output, pending, pending_length, sequence, record, record_length);
+
+    memset(&block, 0, sizeof(block));
+    memcpy(block.magic, LOGGER_FRAME_BLOCK_MAGIC, sizeof(block.magic));
+    block.codec = LOGGER_FRAME_CODEC_NONE;
+    block.raw_offset = sink->raw_offset;
+    block.raw_length = (uint32_t) (sink->block_length + output.length);
+    block.stored_length = block.raw_length;
+    _crash_write(sink->fd, (const char *) &block, sizeof(block));
+    _crash_write(sink->fd, sink->block, sink->block_length);
+
+    output.fd = sink->fd;
+    output.length = 0;
+    _crash_drain_records(logger, &output, pending, pending_length, sequence, record, record_length);
+    fsync(sink->fd);
+}
+
+/*
+ * Direct I/O sinks get the block being written (again, it may not be complete),
+ * the active block and the drained records: O_DIRECT is dropped first so that
+ * none of them need to be aligned.
+ */
+static void _crash_drain_direct(logger_t *logger, _direct_sink_t *sink, const char *pending, size_t pending_length,
+                                uint64_t sequence, const char *record, size_t record_length) {
+    _crash_output_t output;
+    int flight = sink->flight;
+
+#ifdef __linux__
+    fcntl(sink->fd, F_SETFL, fcntl(sink->fd, F_GETFL) & ~O_DIRECT);
+#endif
+    if (flight >= 0) {
+        pwrite(sink->fd, sink->blocks[flight], sink->block_size, (off_t) sink->flight_offset);
+    }
+    pwrite(sink->fd, sink->blocks[sink->active], sink->length, (off_t) sink->offset);
+
+    output.fd = sink->fd;
+    output.offset = (off_t) (sink->offset + sink->length);
+    output.length = 0;
+    _crash_drain_records(logger, &output, pending, pending_length, sequence, record, record_length);
+    ftruncate(sink->fd, output.offset + (off_t) output.length);
+    fsync(sink->fd);
+}
+
+static void _crash_handler(int signum) {
+    char record[_CRASH_RECORD_SIZE];
+    FILE *drained[_LOGGER_REGISTRY_CAPACITY];   /** streams whose stdio buffer was already drained **/
+    const char *pending;
+    size_t pending_length, record_length, staged, drained_count = 0;
+    _crash_output_t output;
+    struct timespec now;
+    uint64_t sequence;
+    logger_t *logger;
+    size_t i, j;
+
+    __atomic_store_n(&_staging_crashing, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < _LOGGER_REGISTRY_CAPACITY; i++) {
+        logger = _logger_registry[i];
+        if (NULL == logger) {
+            continue;
+        }
+        clock_gettime(CLOCK_REALTIME, &now);
+        /* loggers sharing a stream (e.g. stdout) must not write its pending bytes twice */
+        for (j = 0; j < drained_count && drained[j] != logger->_fd; j++) {
+        }
+        if (j < drained_count) {
+            pending = NULL;
+            pending_length = 0;
+        } else {
+            pending = _crash_pending(logger, &pending_length);
+            drained[drained_count++] = logger->_fd;
+        }
+        staged = _crash_staged_count(logger);
+        sequence = _next_sequences(logger, staged + 1);
+        record_length = _crash_format_fatal(logger, signum, (int64_t) now.tv_sec * 1000000000 + now.tv_nsec,
+                                            sequence + staged, record);
+        if (NULL != logger->_frame) {
+            _crash_drain_frame(logger, logger->_frame, pending, pending_length, sequence, record, record_length);
+        } else if (NULL != logger->_direct) {
+            _crash_drain_direct(logger, logger->_direct, pending, pending_length, sequence, record, record_length);
+        } else if (NULL != logger->_shm) {
+            if (pending_length > 0) {
+                logger_shm_push(logger->_shm->ring, logger->_record_level, logger->_record_time,
+                                logger->_record_sequence, pending, pending_length,
+                                "\n", ('\n' != pending[pending_length - 1]) ? 1 : 0);
+            }
+            _crash_drain_staging(logger, NULL, sequence);
+            logger_shm_push(logger->_shm->ring, LOG_LEVEL_FATAL, (int64_t) now.tv_sec * 1000000000 + now.tv_nsec,
+                            sequence + staged, record, record_length, NULL, 0);
+        } else if (logger->_raw_fd >= 0) {
+            output.fd = logger->_raw_fd;
+            output.offset = -1;
+            output.length = 0;
+            _crash_drain_records(logger, &output, pending, pending_length, sequence, record, record_length);
+            fsync(logger->_raw_fd);
+        }
+    }
+
+    /* handlers are installed with SA_RESETHAND: re-raise to get the default action */
+    raise(signum);
+}
+
+/*
+ * Per-thread alternate stacks
+ *
+ * sigaltstack(2) only applies to the calling thread: the stack is released
+ * through a thread-specific key when the thread exits.
+ */
+static void _crash_stack_release(void *memory) {
+    stack_t stack;
+
+    memset(&stack, 0, sizeof(stack));
+    stack.ss_flags = SS_DISABLE;
+    sigaltstack(&stack, NULL);
+    free(memory);
+}
+
+static void _crash_stack_key_create(void) {
+    pthread_key_create(&_crash_stack_key, _crash_stack_release);
+}
+
+void logger_install_crash_stack(void) {
+    stack_t stack;
+
+    pthread_once(&_crash_stack_once, _crash_stack_key_create);
+    if (NULL != pthread_getspecific(_crash_stack_key)) {
+        return;
+    }
+    stack.ss_sp = malloc(_CRASH_STACK_SIZE);
+    if (NULL == stack.ss_sp) {
+        return;
+    }
+    stack.ss_size = _CRASH_STACK_SIZE;
+    stack.ss_flags = 0;
+    if (0 != sigaltstack(&stack, NULL)) {
+        free(stack.ss_sp);
+        return;
+    }
+    pthread_setspecific(_crash_stack_key, stack.ss_sp);
+}
+
+/*
+ * Crash handler installer
+ */
+void logger_install_crash_handler(void) {
+    struct sigaction action;
+    stack_t stack;
+    size_t i;
+
+    stack.ss_sp = _crash_stack;
+    stack.ss_size = sizeof(_crash_stack);
+    stack.ss_flags = 0;
+    sigaltstack(&stack, NULL);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = _crash_handler;
+    action.sa_flags = SA_RESETHAND | SA_ONSTACK | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    for (i = 0; i < sizeof(_crash_signals) / sizeof(_crash_signals[0]); i++) {
+        sigaction(_crash_signals[i], &action, NULL);
+    }
+}
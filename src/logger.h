@@ -44,6 +44,32 @@ typedef enum log_mode_t {
     LOG_MODE_APPEND
 } log_mode_t;
 
+/*
+ * log_compression_t declaration
+ */
+typedef enum log_compression_t {
+    LOG_COMPRESSION_NONE = 0,
+    LOG_COMPRESSION_LZ4,
+    LOG_COMPRESSION_ZSTD
+} log_compression_t;
+
+/*
+ * log_threshold_t declaration: which size the policies' bytes threshold applies to
+ */
+typedef enum log_threshold_t {
+    LOG_THRESHOLD_RAW = 0,
+    LOG_THRESHOLD_STORED
+} log_threshold_t;
+
+/*
+ * log_clock_t declaration: source of the records timestamps
+ */
+typedef enum log_clock_t {
+    LOG_CLOCK_REALTIME = 0,         /** CLOCK_REALTIME, read through the vDSO **/
+    LOG_CLOCK_REALTIME_COARSE,      /** CLOCK_REALTIME_COARSE, cheaper with a resolution of a scheduler tick (Linux only) **/
+    LOG_CLOCK_TSC                   /** invariant TSC anchored to CLOCK_REALTIME once a second **/
+} log_clock_t;
+
 /*
  * logger_t opaque struct declaration
  */
@@ -61,6 +87,77 @@ extern logger_t * file_logger_new(const char *identifier, log_level_t level, con
 extern logger_t * rotating_logger_new(const char *identifier, log_level_t level, const char *file_path, size_t bytes);
 extern logger_t * buffer_logger_new(const char *identifier, log_level_t level, const char *file_path, log_mode_t mode, size_t bytes);
 
+/*
+ * shared memory logger constructor: records are pushed into a lock-free ring in the
+ * POSIX shared memory object `name` (see shm_open(3)) and written out by a collector
+ * process, see logger-collector. records are dropped, never blocking, when the ring is full.
+ * returns NULL where glibc cookie streams are not available.
+ */
+extern logger_t * shm_logger_new(const char *identifier, log_level_t level, const char *name);
+
+/*
+ * shared memory collector: moves the records of the ring `name` into `sink`
+ * applying its level and policy, shm_collector_drain returns the records moved.
+ */
+typedef struct shm_collector_t shm_collector_t;
+
+extern shm_collector_t * shm_collector_new(const char *name);
+extern size_t shm_collector_drain(shm_collector_t *collector, logger_t *sink);
+extern void shm_collector_delete(shm_collector_t **collector);
+
+/*
+ * returns the minimum level logged (LOG_LEVEL_DEBUG is never logged when NDEBUG is set)
+ */
+extern log_level_t logger_get_level(const logger_t *logger);
+
+/*
+ * selects the clock timestamping records (LOG_CLOCK_REALTIME by default), to be called
+ * right after construction. LOG_CLOCK_TSC falls back to LOG_CLOCK_REALTIME if the TSC is not invariant.
+ */
+extern void logger_set_clock(logger_t *logger, log_clock_t clock);
+
+/*
+ * enables a sidecar index (file_path + ".idx") on a file logger: every group of
+ * `records` records is indexed by file offset, time range and levels seen.
+ * rotated and swept segments get their own index. see logger_index.h for the format.
+ */
+extern void logger_enable_index(logger_t *logger, size_t records);
+
+/*
+ * compresses the records of a file logger in independent blocks of `block_size` bytes
+ * (0 for the default) using the seekable format described in logger_frame.h.
+ * codecs not compiled in fall back to LOG_COMPRESSION_NONE, which stores blocks as-is.
+ * `threshold` tells whether the policies' bytes apply to the raw or to the stored size.
+ * needs glibc cookie streams, elsewhere a warning is printed and records are not compressed.
+ * must be called before logging.
+ */
+extern void logger_enable_compression(logger_t *logger, log_compression_t compression, size_t block_size, log_threshold_t threshold);
+
+/*
+ * writes the records of a file logger with O_DIRECT, bypassing the page cache: records
+ * are staged in two aligned blocks of `block_size` bytes (0 for 1MiB) which are written
+ * out by a background thread, so they reach the file a block at a time. the file is
+ * preallocated with fallocate(2), a segment of the policies' bytes at a time.
+ * falls back to buffered writes if the file system does not support O_DIRECT and to the
+ * plain stream outside of Linux and glibc.
+ * cannot be combined with compression, must be called before logging.
+ */
+extern void logger_enable_direct_io(logger_t *logger, size_t block_size);
+
+/*
+ * per-thread staging: every thread formats its records into its own buffer of `bytes`
+ * bytes, without touching shared state. staged records are merged in timestamp order
+ * into the sink, applying its policy, by logger_flush(), when a buffer fills up, every
+ * `interval_ms` milliseconds from a background thread (never if 0) and by logger_delete().
+ * sequence numbers are given in the merged order. must be called before logging.
+ */
+extern void logger_enable_staging(logger_t *logger, size_t bytes, unsigned int interval_ms);
+
+/*
+ * writes out the staged records, if any, and flushes the stream of the logger
+ */
+extern void logger_flush(logger_t *logger);
+
 /*
  * common loggers destructor
  */
@@ -76,6 +173,29 @@ extern void log_warning (logger_t *logger, const char *format, ...);
 extern void log_error   (logger_t *logger, const char *format, ...);
 extern void log_fatal   (logger_t *logger, const char *format, ...);
 
+/*
+ * raw logging functions: the payload is written as-is after the record header
+ * (no formatting, no copy, embedded NULs allowed) applying level filtering and policies.
+ * the payload is not terminated, callers own the trailing newline.
+ */
+struct iovec;
+
+extern void log_write   (logger_t *logger, log_level_t level, const void *data, size_t length);
+extern void log_writev  (logger_t *logger, log_level_t level, const struct iovec *iov, int iovcnt);
+
+/*
+ * installs async-signal-safe handlers for SIGSEGV, SIGBUS, SIGILL, SIGFPE and SIGABRT
+ * which drain every live logger with raw write(2) and append a final FATAL record
+ */
+extern void logger_install_crash_handler(void);
+
+/*
+ * gives the calling thread its own alternate signal stack so that a stack overflow
+ * on that thread still reaches the crash handler; logger_install_crash_handler only
+ * covers the thread that calls it, every other thread calls this once at startup
+ */
+extern void logger_install_crash_stack(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,460 @@
+/*
+ *  C++ Header File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#ifndef __LOGGER_HPP__
+#define __LOGGER_HPP__
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "logger.h"
+
+/*
+ * Header-only C++17 front end.
+ *
+ *   auto logger = liblogger::logger::stream("Service", LOG_LEVEL_INFO, stdout);
+ *   logger.info(LIBLOGGER_FORMAT("{} took {}us"), route, us);
+ *
+ * Format strings use `{}` placeholders (`{{` and `}}` for literal braces) and are
+ * parsed and validated against the arguments at compile time: a mismatch does not
+ * compile. In C++17 they must be wrapped in LIBLOGGER_FORMAT(), in C++20 (consteval)
+ * plain string literals are accepted as well. Arguments are serialized straight into
+ * the record buffer which is handed to log_write(), a newline is appended to each record.
+ * User types are supported by specializing liblogger::formatter.
+ */
+#if defined(__cpp_consteval) && __cpp_consteval >= 201811L
+#define LIBLOGGER_HAS_CONSTEVAL 1
+#else
+#define LIBLOGGER_HAS_CONSTEVAL 0
+#endif
+
+/*
+ * A compile-time format string
+ */
+#define LIBLOGGER_FORMAT(_String)                                                       \
+    [] {                                                                                \
+        struct _format : liblogger::detail::compile_string {                            \
+            static constexpr std::string_view value() {                                 \
+                return _String;                                                         \
+            }                                                                           \
+        };                                                                              \
+        return _format{};                                                               \
+    }()
+
+namespace liblogger {
+
+/*
+ * record buffer: a stack buffer growing on the heap only for oversized records
+ */
+class buffer {
+public:
+    static constexpr std::size_t inline_capacity = 512;
+
+    buffer() noexcept = default;
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+
+    void append(const char *data, std::size_t length) {
+        reserve(length);
+        std::memcpy(_data + _size, data, length);
+        _size += length;
+    }
+
+    void append(std::string_view str) {
+        append(str.data(), str.size());
+    }
+
+    void push_back(char c) {
+        reserve(1);
+        _data[_size++] = c;
+    }
+
+    /* makes room for `length` more bytes, see commit() */
+    char *reserve(std::size_t length) {
+        if (_size + length > _capacity) {
+            std::size_t capacity = (_size + length) * 2;
+            std::unique_ptr<char[]> heap(new char[capacity]);
+            std::memcpy(heap.get(), _data, _size);
+            _heap = std::move(heap);
+            _data = _heap.get();
+            _capacity = capacity;
+        }
+        return _data + _size;
+    }
+
+    void commit(std::size_t length) noexcept {
+        _size += length;
+    }
+
+    const char *data() const noexcept {
+        return _data;
+    }
+
+    std::size_t size() const noexcept {
+        return _size;
+    }
+
+private:
+    char _inline[inline_capacity];
+    std::unique_ptr<char[]> _heap;
+    char *_data = _inline;
+    std::size_t _size = 0;
+    std::size_t _capacity = inline_capacity;
+};
+
+/*
+ * formatter<T>::format(buffer &, const T &) serializes a T, specialize it for user types
+ */
+template <typename T, typename = void>
+struct formatter;
+
+template <>
+struct formatter<bool> {
+    static void format(buffer &out, bool value) {
+        out.append(value ? std::string_view("true") : std::string_view("false"));
+    }
+};
+
+template <>
+struct formatter<char> {
+    static void format(buffer &out, char value) {
+        out.push_back(value);
+    }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>> {
+    static void format(buffer &out, T value) {
+        char *first = out.reserve(24);
+        out.commit(static_cast<std::size_t>(std::to_chars(first, first + 24, value).ptr - first));
+    }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static void format(buffer &out, T value) {
+        char *first = out.reserve(64);
+        out.commit(static_cast<std::size_t>(std::to_chars(first, first + 64, value).ptr - first));
+    }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_enum_v<T>>> {
+    static void format(buffer &out, T value) {
+        formatter<std::underlying_type_t<T>>::format(out, static_cast<std::underlying_type_t<T>>(value));
+    }
+};
+
+template <>
+struct formatter<std::string_view> {
+    static void format(buffer &out, std::string_view value) {
+        out.append(value);
+    }
+};
+
+template <>
+struct formatter<std::string> {
+    static void format(buffer &out, const std::string &value) {
+        out.append(value.data(), value.size());
+    }
+};
+
+template <>
+struct formatter<const char *> {
+    static void format(buffer &out, const char *value) {
+        out.append((nullptr != value) ? std::string_view(value) : std::string_view("(null)"));
+    }
+};
+
+template <>
+struct formatter<char *> : formatter<const char *> {
+};
+
+template <>
+struct formatter<std::nullptr_t> {
+    static void format(buffer &out, std::nullptr_t) {
+        out.append(std::string_view("nullptr"));
+    }
+};
+
+template <typename T>
+struct formatter<T *, std::enable_if_t<!std::is_same_v<std::remove_cv_t<T>, char>>> {
+    static void format(buffer &out, const T *value) {
+        char *first = out.reserve(2 + 2 * sizeof(void *));
+        first[0] = '0';
+        first[1] = 'x';
+        char *last = std::to_chars(first + 2, first + 2 + 2 * sizeof(void *),
+                                   reinterpret_cast<std::uintptr_t>(value), 16).ptr;
+        out.commit(static_cast<std::size_t>(last - first));
+    }
+};
+
+namespace detail {
+
+template <typename T>
+using formatted_t = std::conditional_t<std::is_array_v<std::remove_reference_t<T>>,
+                                       std::decay_t<T>,
+                                       std::remove_cv_t<std::remove_reference_t<T>>>;
+
+template <typename T, typename = void>
+struct is_formattable : std::false_type {
+};
+
+template <typename T>
+struct is_formattable<T, std::void_t<decltype(formatter<T>::format(std::declval<buffer &>(), std::declval<const T &>()))>>
+        : std::true_type {
+};
+
+template <typename T>
+struct type_identity {
+    using type = T;
+};
+
+/*
+ * base of the types made by LIBLOGGER_FORMAT(), whose value() is the format string
+ */
+struct compile_string {
+};
+
+/*
+ * the placeholders offsets of a format string with N arguments, if valid
+ */
+template <std::size_t N>
+struct parsed_format {
+    std::size_t placeholders[N + 1] = {};
+    bool escaped = false;
+    bool valid = false;
+};
+
+template <std::size_t N>
+constexpr parsed_format<N> parse_format(std::string_view str) {
+    parsed_format<N> parsed;
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < str.size(); i++) {
+        if ('{' == str[i] && i + 1 < str.size() && '}' == str[i + 1]) {
+            if (N == count) {
+                return parsed;
+            }
+            parsed.placeholders[count++] = i++;
+        } else if (('{' == str[i] || '}' == str[i]) && i + 1 < str.size() && str[i] == str[i + 1]) {
+            parsed.escaped = true;
+            i++;
+        } else if ('{' == str[i] || '}' == str[i]) {
+            return parsed;
+        }
+    }
+    parsed.valid = (N == count);
+    return parsed;
+}
+
+template <typename S, std::size_t N>
+inline constexpr parsed_format<N> parsed_format_v = parse_format<N>(S::value());
+
+#if LIBLOGGER_HAS_CONSTEVAL
+/*
+ * not constexpr (nor defined) on purpose: reaching it from the consteval constructor is a compile error
+ */
+void format_string_does_not_match_arguments();
+#endif
+
+}  // namespace detail
+
+/*
+ * format_string<Args...>: a `{}` format string parsed and checked against Args at compile time
+ */
+template <typename... Args>
+class format_string {
+    static_assert((detail::is_formattable<detail::formatted_t<Args>>::value && ...),
+                  "argument type has no liblogger::formatter specialization");
+
+public:
+    using parsed_type = detail::parsed_format<sizeof...(Args)>;
+
+    template <typename S, typename = std::enable_if_t<std::is_base_of_v<detail::compile_string, S>>>
+    constexpr format_string(S) : _str(S::value()), _parsed(detail::parsed_format_v<S, sizeof...(Args)>) {
+        static_assert(detail::parsed_format_v<S, sizeof...(Args)>.valid, "format string does not match the arguments");
+    }
+
+#if LIBLOGGER_HAS_CONSTEVAL
+    template <typename S, typename = std::enable_if_t<std::is_convertible_v<const S &, std::string_view>>, typename = void>
+    consteval format_string(const S &str) : _str(str), _parsed(detail::parse_format<sizeof...(Args)>(_str)) {
+        if (!_parsed.valid) {
+            detail::format_string_does_not_match_arguments();
+        }
+    }
+#endif
+
+    constexpr std::string_view get() const noexcept {
+        return _str;
+    }
+
+    constexpr const parsed_type &parsed() const noexcept {
+        return _parsed;
+    }
+
+private:
+    std::string_view _str;
+    parsed_type _parsed;
+};
+
+template <typename... Args>
+using format_string_t = format_string<typename detail::type_identity<Args>::type...>;
+
+namespace detail {
+
+/*
+ * copies literal text, collapsing `{{` and `}}` when the format string has any
+ */
+inline void format_literal(buffer &out, std::string_view str, bool escaped) {
+    if (!escaped) {
+        out.append(str);
+        return;
+    }
+    for (std::size_t i = 0; i < str.size(); i++) {
+        out.push_back(str[i]);
+        if (('{' == str[i] || '}' == str[i]) && i + 1 < str.size() && str[i] == str[i + 1]) {
+            i++;
+        }
+    }
+}
+
+template <std::size_t N, typename... Args>
+void format(buffer &out, std::string_view str, const parsed_format<N> &parsed, const Args &... args) {
+    std::size_t position = 0, i = 0;
+    ((format_literal(out, str.substr(position, parsed.placeholders[i] - position), parsed.escaped),
+      position = parsed.placeholders[i++] + 2,
+      formatter<formatted_t<Args>>::format(out, args)), ...);
+    format_literal(out, str.substr(position), parsed.escaped);
+}
+
+}  // namespace detail
+
+/*
+ * logger: owns a logger_t, deleting it when going out of scope
+ */
+class logger {
+public:
+    explicit logger(logger_t *handle) noexcept : _handle(handle) {
+    }
+
+    logger(logger &&other) noexcept : _handle(other.release()) {
+    }
+
+    logger &operator=(logger &&other) noexcept {
+        if (this != &other) {
+            reset(other.release());
+        }
+        return *this;
+    }
+
+    logger(const logger &) = delete;
+    logger &operator=(const logger &) = delete;
+
+    ~logger() {
+        reset();
+    }
+
+    static logger stream(const char *identifier, log_level_t level, FILE *stream) {
+        return logger(stream_logger_new(identifier, level, stream));
+    }
+
+    static logger file(const char *identifier, log_level_t level, const char *file_path, log_mode_t mode) {
+        return logger(file_logger_new(identifier, level, file_path, mode));
+    }
+
+    static logger rotating(const char *identifier, log_level_t level, const char *file_path, std::size_t bytes) {
+        return logger(rotating_logger_new(identifier, level, file_path, bytes));
+    }
+
+    static logger buffered(const char *identifier, log_level_t level, const char *file_path, log_mode_t mode,
+                           std::size_t bytes) {
+        return logger(buffer_logger_new(identifier, level, file_path, mode, bytes));
+    }
+
+    logger_t *get() const noexcept {
+        return _handle;
+    }
+
+    logger_t *release() noexcept {
+        logger_t *handle = _handle;
+        _handle = nullptr;
+        return handle;
+    }
+
+    void reset(logger_t *handle = nullptr) noexcept {
+        logger_t *old = _handle;
+        _handle = handle;
+        logger_delete(&old);
+    }
+
+    explicit operator bool() const noexcept {
+        return nullptr != _handle;
+    }
+
+    void flush() noexcept {
+        logger_flush(_handle);
+    }
+
+    bool enabled(log_level_t level) const noexcept {
+        return nullptr != _handle && level >= logger_get_level(_handle);
+    }
+
+    template <typename... Args>
+    void log(log_level_t level, format_string_t<Args...> format, const Args &... args) {
+        if (enabled(level)) {
+            buffer record;
+            detail::format(record, format.get(), format.parsed(), args...);
+            record.push_back('\n');
+            log_write(_handle, level, record.data(), record.size());
+        }
+    }
+
+    template <typename... Args>
+    void debug(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_DEBUG, format, args...);
+    }
+
+    template <typename... Args>
+    void notice(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_NOTICE, format, args...);
+    }
+
+    template <typename... Args>
+    void info(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_INFO, format, args...);
+    }
+
+    template <typename... Args>
+    void warning(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_WARNING, format, args...);
+    }
+
+    template <typename... Args>
+    void error(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_ERROR, format, args...);
+    }
+
+    template <typename... Args>
+    void fatal(format_string_t<Args...> format, const Args &... args) {
+        log(LOG_LEVEL_FATAL, format, args...);
+    }
+
+private:
+    logger_t *_handle;
+};
+
+}  // namespace liblogger
+
+#endif /* __LOGGER_HPP__ */
@@ -0,0 +1,172 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if LOGGER_WITH_LZ4
+#include <lz4.h>
+#endif
+#if LOGGER_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "logger_frame.h"
+
+
+#ifndef LOGGER_WITH_LZ4
+#define LOGGER_WITH_LZ4 0
+#endif
+
+#ifndef LOGGER_WITH_ZSTD
+#define LOGGER_WITH_ZSTD 0
+#endif
+
+#define _ZSTD_LEVEL     1
+
+/*
+ * Codec helpers
+ */
+int logger_frame_codec_available(uint32_t codec) {
+    switch (codec) {
+        case LOGGER_FRAME_CODEC_NONE:
+            return 1;
+        case LOGGER_FRAME_CODEC_LZ4:
+            return LOGGER_WITH_LZ4;
+        case LOGGER_FRAME_CODEC_ZSTD:
+            return LOGGER_WITH_ZSTD;
+        default:
+            return 0;
+    }
+}
+
+size_t logger_frame_bound(uint32_t codec, size_t length) {
+    switch (codec) {
+#if LOGGER_WITH_LZ4
+        case LOGGER_FRAME_CODEC_LZ4:
+            return (size_t) LZ4_compressBound((int) length);
+#endif
+#if LOGGER_WITH_ZSTD
+        case LOGGER_FRAME_CODEC_ZSTD:
+            return ZSTD_compressBound(length);
+#endif
+        default:
+            return length;
+    }
+}
+
+size_t logger_frame_compress(uint32_t codec, const void *src, size_t length, void *dst, size_t capacity) {
+    size_t result = 0;
+    switch (codec) {
+        case LOGGER_FRAME_CODEC_NONE:
+            if (length <= capacity) {
+                memcpy(dst, src, length);
+                result = length;
+            }
+            break;
+#if LOGGER_WITH_LZ4
+        case LOGGER_FRAME_CODEC_LZ4: {
+            int n = LZ4_compress_default((const char *) src, (char *) dst, (int) length, (int) capacity);
+            result = (n > 0) ? (size_t) n : 0;
+            break;
+        }
+#endif
+#if LOGGER_WITH_ZSTD
+        case LOGGER_FRAME_CODEC_ZSTD:
+            result = ZSTD_compress(dst, capacity, src, length, _ZSTD_LEVEL);
+            result = ZSTD_isError(result) ? 0 : result;
+            break;
+#endif
+        default:
+            break;
+    }
+    return result;
+}
+
+int logger_frame_decompress(uint32_t codec, const void *src, size_t length, void *dst, size_t raw_length) {
+    switch (codec) {
+        case LOGGER_FRAME_CODEC_NONE:
+            if (length != raw_length) {
+                return 0;
+            }
+            memcpy(dst, src, length);
+            return 1;
+#if LOGGER_WITH_LZ4
+        case LOGGER_FRAME_CODEC_LZ4:
+            return LZ4_decompress_safe((const char *) src, (char *) dst, (int) length, (int) raw_length) == (int) raw_length;
+#endif
+#if LOGGER_WITH_ZSTD
+        case LOGGER_FRAME_CODEC_ZSTD:
+            return ZSTD_decompress(dst, raw_length, src, length) == raw_length;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Reader helpers
+ */
+logger_frame_entry_t *logger_frame_scan(FILE *file, size_t *count) {
+    logger_frame_header_t header;
+    logger_frame_entry_t *entries, *tmp;
+    logger_frame_block_t block;
+    size_t capacity = 64;
+    long offset, size;
+
+    *count = 0;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (1 != fread(&header, sizeof(header), 1, file) ||
+        0 != memcmp(header.magic, LOGGER_FRAME_MAGIC, sizeof(header.magic)) ||
+        LOGGER_FRAME_VERSION != header.version) {
+        return NULL;
+    }
+
+    entries = malloc(capacity * sizeof(*entries));
+    if (NULL == entries) {
+        abort();
+    }
+    offset = (long) sizeof(header);
+    while (fseek(file, offset, SEEK_SET) == 0 && 1 == fread(&block, sizeof(block), 1, file)) {
+        offset += (long) sizeof(block);
+        if (0 != memcmp(block.magic, LOGGER_FRAME_BLOCK_MAGIC, sizeof(block.magic)) ||
+            offset + (long) block.stored_length > size) {
+            break;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            tmp = realloc(entries, capacity * sizeof(*entries));
+            if (NULL == tmp) {
+                abort();
+            }
+            entries = tmp;
+        }
+        entries[*count].block = block;
+        entries[*count].offset = (uint64_t) offset;
+        *count += 1;
+        offset += (long) block.stored_length;
+    }
+    return entries;
+}
+
+int logger_frame_read_block(FILE *file, const logger_frame_entry_t *entry, void *raw) {
+    int result = 0;
+    void *stored = malloc(entry->block.stored_length + 1);
+    if (NULL == stored) {
+        abort();
+    }
+    if (0 == fseek(file, (long) entry->offset, SEEK_SET) &&
+        entry->block.stored_length == fread(stored, 1, entry->block.stored_length, file)) {
+        result = logger_frame_decompress(entry->block.codec, stored, entry->block.stored_length,
+                                         raw, entry->block.raw_length);
+    }
+    free(stored);
+    return result;
+}
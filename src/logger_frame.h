@@ -0,0 +1,83 @@
+/*
+ *  C Header File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+#ifndef __LOGGER_FRAME_H__
+#define __LOGGER_FRAME_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed log files on-disk format
+ *
+ * A logger_frame_header_t followed by a sequence of blocks, each one made of a
+ * logger_frame_block_t and its payload. Blocks are compressed independently so
+ * any block can be decoded on its own, and each one records the offset of its
+ * first byte in the uncompressed stream so readers can seek without decoding.
+ * A crash loses at most the block being written, which readers detect as torn.
+ * Integers are stored in host byte order.
+ */
+#define LOGGER_FRAME_MAGIC          "LGFR"
+#define LOGGER_FRAME_BLOCK_MAGIC    "LGBK"
+#define LOGGER_FRAME_VERSION        1
+
+/*
+ * codecs, values match log_compression_t
+ */
+#define LOGGER_FRAME_CODEC_NONE     0
+#define LOGGER_FRAME_CODEC_LZ4      1
+#define LOGGER_FRAME_CODEC_ZSTD     2
+
+typedef struct logger_frame_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t block_size;        /** uncompressed size of full blocks **/
+    uint32_t reserved;
+} logger_frame_header_t;
+
+typedef struct logger_frame_block_t {
+    char magic[4];
+    uint32_t codec;
+    uint64_t raw_offset;        /** offset of the first byte of the block in the uncompressed stream **/
+    uint32_t raw_length;        /** uncompressed length **/
+    uint32_t stored_length;     /** length of the payload following this header **/
+} logger_frame_block_t;
+
+typedef struct logger_frame_entry_t {
+    logger_frame_block_t block;
+    uint64_t offset;            /** file offset of the payload **/
+} logger_frame_entry_t;
+
+/*
+ * codec helpers
+ */
+extern int logger_frame_codec_available(uint32_t codec);
+extern size_t logger_frame_bound(uint32_t codec, size_t length);
+extern size_t logger_frame_compress(uint32_t codec, const void *src, size_t length, void *dst, size_t capacity);
+extern int logger_frame_decompress(uint32_t codec, const void *src, size_t length, void *dst, size_t raw_length);
+
+/*
+ * reader helpers
+ *
+ * logger_frame_scan returns NULL if the file is not a compressed log file, otherwise the
+ * (possibly empty) list of its complete blocks, stopping at the first torn one.
+ * logger_frame_read_block decodes a block into `raw` which must hold raw_length bytes.
+ */
+extern logger_frame_entry_t *logger_frame_scan(FILE *file, size_t *count);
+extern int logger_frame_read_block(FILE *file, const logger_frame_entry_t *entry, void *raw);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOGGER_FRAME_H__ */
@@ -0,0 +1,54 @@
+/*
+ *  C Header File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#include <stdint.h>
+
+
+#ifndef __LOGGER_INDEX_H__
+#define __LOGGER_INDEX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sidecar index on-disk format
+ *
+ * The index of a log file lives next to it with the LOGGER_INDEX_EXTENSION
+ * appended to its name. It is made of a logger_index_header_t followed by a
+ * sequence of logger_index_entry_t, one for every group of N records written.
+ * Integers are stored in host byte order.
+ *
+ * Records are not written in timestamp order (staging, collectors, clock
+ * steps), so each entry bounds its group with the extreme timestamps seen.
+ */
+#define LOGGER_INDEX_EXTENSION  ".idx"
+#define LOGGER_INDEX_MAGIC      "LGIX"
+#define LOGGER_INDEX_VERSION    2
+
+typedef struct logger_index_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t records;       /** records per group **/
+    uint32_t reserved;
+} logger_index_header_t;
+
+typedef struct logger_index_entry_t {
+    uint64_t offset;        /** file offset of the first record of the group **/
+    uint64_t length;        /** bytes spanned by the group **/
+    int64_t min_ns;         /** earliest timestamp in the group, nanoseconds since the epoch **/
+    int64_t max_ns;         /** latest timestamp in the group, nanoseconds since the epoch **/
+    uint32_t count;         /** records in the group **/
+    uint32_t levels;        /** bitmap of the levels seen: bit n is set for log_level_t n **/
+} logger_index_entry_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOGGER_INDEX_H__ */
@@ -0,0 +1,225 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "logger_shm.h"
+
+
+#define _LOAD(_Ptr)             __atomic_load_n((_Ptr), __ATOMIC_ACQUIRE)
+#define _STORE(_Ptr, _Value)    __atomic_store_n((_Ptr), (_Value), __ATOMIC_RELEASE)
+
+/*
+ * Ring mapping
+ */
+logger_shm_ring_t *logger_shm_open(const char *name) {
+    logger_shm_ring_t *ring;
+    struct stat info;
+    uint32_t expected = 0;
+    uint64_t i;
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    if (0 != fstat(fd, &info) ||
+        ((size_t) info.st_size < sizeof(logger_shm_ring_t) && 0 != ftruncate(fd, sizeof(logger_shm_ring_t)))) {
+        close(fd);
+        return NULL;
+    }
+    ring = mmap(NULL, sizeof(logger_shm_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == ring) {
+        return NULL;
+    }
+
+    /* the first process mapping the ring initializes it, the others wait for it */
+    if (__atomic_compare_exchange_n(&ring->state, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        memcpy(ring->magic, LOGGER_SHM_MAGIC, sizeof(ring->magic));
+        ring->version = LOGGER_SHM_VERSION;
+        ring->capacity = LOGGER_SHM_CAPACITY;
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->sequence = 0;
+        for (i = 0; i < LOGGER_SHM_CAPACITY; i++) {
+            ring->slots[i].turn = i;
+        }
+        _STORE(&ring->state, 2);
+    }
+    while (2 != _LOAD(&ring->state)) {
+        sched_yield();
+    }
+
+    if (0 != memcmp(ring->magic, LOGGER_SHM_MAGIC, sizeof(ring->magic)) ||
+        LOGGER_SHM_VERSION != ring->version || LOGGER_SHM_CAPACITY != ring->capacity) {
+        munmap(ring, sizeof(logger_shm_ring_t));
+        return NULL;
+    }
+    return ring;
+}
+
+void logger_shm_close(logger_shm_ring_t *ring) {
+    if (NULL != ring) {
+        munmap(ring, sizeof(logger_shm_ring_t));
+    }
+}
+
+/*
+ * Producer side
+ */
+int logger_shm_push(logger_shm_ring_t *ring, int level, int64_t timestamp, uint64_t sequence,
+                    const char *a, size_t a_length, const char *b, size_t b_length) {
+    logger_shm_slot_t *slot;
+    uint64_t tail, head, slots, i;
+    size_t length, offset, n;
+
+    if (a_length + b_length > LOGGER_SHM_MAX_RECORD) {
+        a_length = (a_length < LOGGER_SHM_MAX_RECORD) ? a_length : LOGGER_SHM_MAX_RECORD;
+        b_length = LOGGER_SHM_MAX_RECORD - a_length;
+    }
+    length = a_length + b_length;
+    slots = (length + LOGGER_SHM_SLOT_DATA - 1) / LOGGER_SHM_SLOT_DATA;
+    slots = (slots > 0) ? slots : 1;
+
+    tail = _LOAD(&ring->tail);
+    do {
+        head = _LOAD(&ring->head);
+        if (tail + slots - head > LOGGER_SHM_CAPACITY) {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->tail, &tail, tail + slots, 1, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+    /* claim: from now on the consumer knows who owns the reservation and how large it is */
+    slot = &ring->slots[tail % LOGGER_SHM_CAPACITY];
+    if (_LOAD(&slot->turn) != tail) {
+        return 0;
+    }
+    slot->owner = (int32_t) getpid();
+    slot->slots = (uint16_t) slots;
+    head = tail;
+    if (!__atomic_compare_exchange_n(&slot->turn, &head, tail | LOGGER_SHM_CLAIMED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* skipped by the consumer while unclaimed, which counted it as dropped */
+        return 0;
+    }
+
+    /*
+     * the first slot is published last: until the whole record is written it stays
+     * claimed, so that the consumer can reap it if the producer dies meanwhile
+     */
+    for (i = slots; i-- > 0;) {
+        slot = &ring->slots[(tail + i) % LOGGER_SHM_CAPACITY];
+        offset = (size_t) i * LOGGER_SHM_SLOT_DATA;
+        slot->sequence = sequence;
+        slot->timestamp = timestamp;
+        slot->length = (0 == i) ? (uint32_t) length : 0;
+        slot->slots = (0 == i) ? (uint16_t) slots : 0;
+        slot->level = (uint16_t) level;
+        slot->owner = (0 == i) ? slot->owner : 0;
+        for (n = 0; n < LOGGER_SHM_SLOT_DATA && offset < length; n++, offset++) {
+            slot->data[n] = (offset < a_length) ? a[offset] : b[offset - a_length];
+        }
+        _STORE(&slot->turn, tail + i + 1);
+    }
+    return 1;
+}
+
+/*
+ * Consumer side
+ */
+static void _release(logger_shm_ring_t *ring, uint64_t slots) {
+    uint64_t head = ring->head, i;
+    logger_shm_slot_t *slot;
+    for (i = 0; i < slots; i++) {
+        slot = &ring->slots[(head + i) % LOGGER_SHM_CAPACITY];
+        /* a reservation whose producer dies before writing its size must not inherit this one */
+        slot->slots = 0;
+        _STORE(&slot->turn, head + i + LOGGER_SHM_CAPACITY);
+    }
+    _STORE(&ring->head, head + slots);
+}
+
+size_t logger_shm_pop(logger_shm_ring_t *ring, char *buffer, int *level, int64_t *timestamp, uint64_t *sequence) {
+    uint64_t head = ring->head, i;
+    logger_shm_slot_t *slot = &ring->slots[head % LOGGER_SHM_CAPACITY];
+    size_t length, offset, n;
+
+    if (_LOAD(&slot->turn) != head + 1) {
+        return 0;
+    }
+    for (i = 1; i < slot->slots; i++) {
+        if (_LOAD(&ring->slots[(head + i) % LOGGER_SHM_CAPACITY].turn) != head + i + 1) {
+            return 0;
+        }
+    }
+
+    length = slot->length;
+    *level = slot->level;
+    *timestamp = slot->timestamp;
+    *sequence = slot->sequence;
+    for (i = 0, offset = 0; offset < length; i++, offset += n) {
+        n = (length - offset < LOGGER_SHM_SLOT_DATA) ? length - offset : LOGGER_SHM_SLOT_DATA;
+        memcpy(buffer + offset, ring->slots[(head + i) % LOGGER_SHM_CAPACITY].data, n);
+    }
+    _release(ring, slot->slots);
+    return length;
+}
+
+int logger_shm_reap(logger_shm_ring_t *ring) {
+    uint64_t head = ring->head;
+    logger_shm_slot_t *slot = &ring->slots[head % LOGGER_SHM_CAPACITY];
+
+    if (_LOAD(&slot->turn) != (head | LOGGER_SHM_CLAIMED) || 0 == kill(slot->owner, 0) || ESRCH != errno) {
+        return 0;
+    }
+    /* the owner died before publishing: its slots will never be written again */
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    _release(ring, slot->slots);
+    return 1;
+}
+
+int logger_shm_unclaimed(logger_shm_ring_t *ring) {
+    uint64_t head = ring->head;
+    return _LOAD(&ring->tail) != head && _LOAD(&ring->slots[head % LOGGER_SHM_CAPACITY].turn) == head;
+}
+
+void logger_shm_skip(logger_shm_ring_t *ring, uint64_t limit) {
+    uint64_t head = ring->head, position, expected, dropped = 0;
+    logger_shm_slot_t *slot;
+    int first;
+
+    /*
+     * each slot is taken away with a CAS, so that a late claim fails instead of writing into it.
+     * a reservation starts at the head and wherever its producer managed to write its size.
+     */
+    for (position = head; position < limit; position++) {
+        slot = &ring->slots[position % LOGGER_SHM_CAPACITY];
+        first = (position == head || 0 != slot->slots);
+        expected = position;
+        if (!__atomic_compare_exchange_n(&slot->turn, &expected, position + LOGGER_SHM_CAPACITY,
+                                         0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        slot->slots = 0;
+        dropped += (uint64_t) first;
+    }
+    if (position > head) {
+        __atomic_fetch_add(&ring->dropped, dropped, __ATOMIC_RELAXED);
+        _STORE(&ring->head, position);
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ *  C Header File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifndef __LOGGER_SHM_H__
+#define __LOGGER_SHM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared memory ring layout
+ *
+ * A bounded multi-producer single-consumer queue of fixed-size slots living in
+ * POSIX shared memory. Producers reserve consecutive slots with a CAS on `tail`
+ * (dropping the record if the ring is full, never blocking), claim the reservation
+ * recording their pid and its size in the first slot and moving its `turn` from
+ * the position to position | LOGGER_SHM_CLAIMED with a CAS, then publish each
+ * slot by storing its position + 1 in `turn`, the first one last so that the
+ * reservation stays claimed until the whole record is written. The consumer releases a slot
+ * storing its position + capacity in `turn`, then advances `head`.
+ * `sequence` numbers the records of all the producers sharing the ring.
+ * A record spanning several slots is described by its first slot, the
+ * following ones only carry data.
+ *
+ * The consumer skips at once a claimed reservation whose owner died, and the
+ * unclaimed slots at the head (the producer died right after reserving them) only
+ * once it has been stuck on them for a while: its CAS on `turn` makes a late claim
+ * fail. Only the slots already reserved when it got stuck are skipped, never the
+ * fresh reservations of live producers. Released slots have their `slots` cleared,
+ * which tells where the skipped reservations started.
+ */
+#define LOGGER_SHM_MAGIC        "LGSH"
+#define LOGGER_SHM_VERSION      4
+#define LOGGER_SHM_SLOT_SIZE    256
+#define LOGGER_SHM_CAPACITY     16384                       /** slots, 4MiB **/
+#define LOGGER_SHM_MAX_SLOTS    256                         /** slots per record **/
+#define LOGGER_SHM_SLOT_DATA    (LOGGER_SHM_SLOT_SIZE - 40)
+#define LOGGER_SHM_CLAIMED      (1ULL << 63)
+#define LOGGER_SHM_MAX_RECORD   (LOGGER_SHM_MAX_SLOTS * LOGGER_SHM_SLOT_DATA)
+
+typedef struct logger_shm_slot_t {
+    uint64_t turn;
+    uint64_t sequence;          /** record sequence number **/
+    int64_t timestamp;          /** record timestamp, nanoseconds since the epoch **/
+    uint32_t length;            /** record length, 0 in continuation slots **/
+    uint16_t slots;             /** slots spanned by the record, 0 in continuation slots **/
+    uint16_t level;             /** log_level_t of the record **/
+    int32_t owner;              /** pid of the producer, 0 in continuation slots **/
+    uint32_t reserved;
+    char data[LOGGER_SHM_SLOT_DATA];
+} logger_shm_slot_t;
+
+typedef struct logger_shm_ring_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t state;             /** 0: uninitialized, 1: initializing, 2: ready **/
+    char _pad0[48];
+    uint64_t head;              /** next position to consume, written by the consumer only **/
+    char _pad1[56];
+    uint64_t tail;              /** next position to reserve **/
+    char _pad2[56];
+    uint64_t dropped;           /** records dropped because the ring was full **/
+    char _pad3[56];
+    uint64_t sequence;          /** next record sequence number **/
+    char _pad4[56];
+    logger_shm_slot_t slots[LOGGER_SHM_CAPACITY];
+} logger_shm_ring_t;
+
+/*
+ * maps the ring named `name` (see shm_open(3)), creating it if needed; NULL on failure
+ */
+extern logger_shm_ring_t *logger_shm_open(const char *name);
+extern void logger_shm_close(logger_shm_ring_t *ring);
+
+/*
+ * producer side, async-signal-safe: returns 0 if the record was dropped.
+ * records longer than LOGGER_SHM_MAX_RECORD are truncated.
+ */
+extern int logger_shm_push(logger_shm_ring_t *ring, int level, int64_t timestamp, uint64_t sequence,
+                           const char *a, size_t a_length, const char *b, size_t b_length);
+
+/*
+ * consumer side: copies the next published record into `buffer` (LOGGER_SHM_MAX_RECORD bytes)
+ * returning its length, 0 if there is none.
+ */
+extern size_t logger_shm_pop(logger_shm_ring_t *ring, char *buffer, int *level, int64_t *timestamp, uint64_t *sequence);
+
+/*
+ * consumer side recovery, skipped records are counted as dropped.
+ * logger_shm_reap skips the reservation at the head if its owner died, returning 1 if it did.
+ * logger_shm_unclaimed tells whether the head slot is reserved but not claimed yet,
+ * logger_shm_skip skips the unclaimed slots at the head up to `limit`, the tail when they were
+ * found unclaimed: call it once they have been for a while.
+ */
+extern int logger_shm_reap(logger_shm_ring_t *ring);
+extern int logger_shm_unclaimed(logger_shm_ring_t *ring);
+extern void logger_shm_skip(logger_shm_ring_t *ring, uint64_t limit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LOGGER_SHM_H__ */
@@ -0,0 +1,176 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "logger.h"
+#include "logger_shm.h"
+
+
+#define _RECORD_SLOTS   3
+#define _RECORD_LENGTH  (_RECORD_SLOTS * LOGGER_SHM_SLOT_DATA)
+
+static int _failures = 0;
+
+#define _CHECK(_Condition) \
+    do { \
+        if (!(_Condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #_Condition); \
+            _failures++; \
+        } \
+    } while (0)
+
+/*
+ * Forks a producer which dies of SIGSEGV in logger_shm_push while copying slot `faulting`
+ * of its record. Every slot before it is unreadable as well if `after` is set, every slot
+ * after it otherwise: the producer dies having already written the readable slots.
+ */
+static void _push_and_die(logger_shm_ring_t *ring, int faulting, int after) {
+    long page = sysconf(_SC_PAGESIZE);
+    const char *record;
+    char *pages;
+    int status;
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        pages = mmap(NULL, (size_t) page * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == pages) {
+            _exit(EXIT_FAILURE);
+        }
+        memset(pages, 'x', (size_t) page * 3);
+        mprotect(pages + page, (size_t) page, PROT_NONE);
+        record = after ? pages + page * 2 - (faulting + 1) * LOGGER_SHM_SLOT_DATA
+                       : pages + page - faulting * LOGGER_SHM_SLOT_DATA;
+        logger_shm_push(ring, LOG_LEVEL_INFO, 0, 0, record, _RECORD_LENGTH, NULL, 0);
+        _exit(EXIT_FAILURE);
+    }
+    _CHECK(pid > 0 && pid == waitpid(pid, &status, 0) && WIFSIGNALED(status));
+}
+
+/*
+ * Drains the ring into a stream logger, returning the records collected.
+ */
+static size_t _drain(shm_collector_t *collector, char *output, size_t size) {
+    FILE *stream = tmpfile();
+    logger_t *sink = stream_logger_new("test", LOG_LEVEL_DEBUG, stream);
+    size_t records, length;
+
+    records = shm_collector_drain(collector, sink);
+    fflush(stream);
+    rewind(stream);
+    length = fread(output, 1, size - 1, stream);
+    output[length] = '\0';
+    logger_delete(&sink);
+    fclose(stream);
+    return records;
+}
+
+/*
+ * Forks a producer which dies right after reserving `slots` slots, having
+ * written the size of its reservation if `sized` is set.
+ */
+static void _reserve_and_die(logger_shm_ring_t *ring, uint64_t slots, int sized) {
+    uint64_t tail;
+    int status;
+    pid_t pid = fork();
+
+    if (0 == pid) {
+        tail = __atomic_fetch_add(&ring->tail, slots, __ATOMIC_ACQ_REL);
+        if (sized) {
+            ring->slots[tail % LOGGER_SHM_CAPACITY].slots = (uint16_t) slots;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    _CHECK(pid > 0 && pid == waitpid(pid, &status, 0));
+}
+
+/*
+ * A producer dying in logger_shm_push must not block the records pushed after it.
+ */
+static void _test_producer_death(int faulting, int after) {
+    char name[64], output[4096];
+    logger_shm_ring_t *ring;
+    shm_collector_t *collector;
+
+    sprintf(name, "/liblogger-test-shm-%d-%d-%d", (int) getpid(), faulting, after);
+    ring = logger_shm_open(name);
+    _CHECK(NULL != ring);
+    if (NULL == ring) {
+        return;
+    }
+
+    collector = shm_collector_new(name);
+    _push_and_die(ring, faulting, after);
+    _CHECK(1 == logger_shm_push(ring, LOG_LEVEL_INFO, 0, 1, "after\n", 6, NULL, 0));
+    _CHECK(1 == _drain(collector, output, sizeof(output)));
+    _CHECK(NULL != strstr(output, "after\n"));
+    _CHECK(NULL == strchr(output, 'x'));
+    _CHECK(1 == ring->dropped);
+    _CHECK(ring->head == ring->tail);
+
+    shm_collector_delete(&collector);
+    logger_shm_close(ring);
+    shm_unlink(name);
+}
+
+/*
+ * Unclaimed reservations are skipped once stuck for a while, but only the ones
+ * made before the collector got stuck on them: later ones may belong to live producers.
+ */
+static void _test_stalled_reservations(void) {
+    char name[64], output[4096];
+    logger_shm_ring_t *ring;
+    shm_collector_t *collector;
+    uint64_t fresh;
+
+    sprintf(name, "/liblogger-test-shm-%d-stall", (int) getpid());
+    ring = logger_shm_open(name);
+    _CHECK(NULL != ring);
+    if (NULL == ring) {
+        return;
+    }
+    collector = shm_collector_new(name);
+
+    _reserve_and_die(ring, 2, 0);
+    _reserve_and_die(ring, 3, 1);
+    _CHECK(0 == _drain(collector, output, sizeof(output)));
+
+    /* a live producer reserving after the collector got stuck, not claimed yet */
+    fresh = __atomic_fetch_add(&ring->tail, 1, __ATOMIC_ACQ_REL);
+    sleep(3);
+    _CHECK(0 == _drain(collector, output, sizeof(output)));
+    _CHECK(2 == ring->dropped);
+    _CHECK(fresh == ring->head);
+
+    shm_collector_delete(&collector);
+    logger_shm_close(ring);
+    shm_unlink(name);
+}
+
+int main(void) {
+    /* dies before publishing anything, the first slot being readable: the record is still claimed */
+    _test_producer_death(1, 0);
+    _test_producer_death(_RECORD_SLOTS - 1, 0);
+    /* dies after publishing the last slots */
+    _test_producer_death(0, 1);
+    _test_producer_death(1, 1);
+    _test_stalled_reservations();
+
+    if (_failures > 0) {
+        fprintf(stderr, "%d checks failed\n", _failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logger_frame.h"
+
+
+/*
+ * Usage
+ */
+static void _usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s FILE...\n"
+            "\n"
+            "Decompresses the given log files to the standard output.\n"
+            "Files which are not compressed are copied as they are.\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+static int _cat_plain(FILE *file) {
+    char buffer[65536];
+    size_t n;
+    fseek(file, 0, SEEK_SET);
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        fwrite(buffer, 1, n, stdout);
+    }
+    return 1;
+}
+
+static int _cat_frame(const char *file_path, FILE *file, const logger_frame_entry_t *entries, size_t count) {
+    size_t i;
+    char *raw;
+    for (i = 0; i < count; i++) {
+        raw = malloc(entries[i].block.raw_length + 1);
+        if (NULL == raw) {
+            abort();
+        }
+        if (!logger_frame_read_block(file, &entries[i], raw)) {
+            fprintf(stderr, "Unable to decode block %lu of: '%s'\n", (unsigned long) i, file_path);
+            free(raw);
+            return 0;
+        }
+        fwrite(raw, 1, entries[i].block.raw_length, stdout);
+        free(raw);
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    logger_frame_entry_t *entries;
+    size_t count;
+    FILE *file;
+    int i, result = EXIT_SUCCESS;
+
+    if (argc < 2) {
+        _usage(argv[0]);
+    }
+
+    for (i = 1; i < argc; i++) {
+        file = fopen(argv[i], "rb");
+        if (NULL == file) {
+            fprintf(stderr, "Unable to open file: '%s'\n", argv[i]);
+            result = EXIT_FAILURE;
+            continue;
+        }
+        entries = logger_frame_scan(file, &count);
+        if (!((NULL == entries) ? _cat_plain(file) : _cat_frame(argv[i], file, entries, count))) {
+            result = EXIT_FAILURE;
+        }
+        free(entries);
+        fclose(file);
+    }
+    return result;
+}
@@ -0,0 +1,92 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <time.h>
+
+#include "logger.h"
+
+
+#define _IDLE_NANOSECONDS   1000000
+
+static volatile sig_atomic_t _running = 1;
+
+static void _stop(int signum) {
+    (void) signum;
+    _running = 0;
+}
+
+/*
+ * Usage
+ */
+static void _usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-b BYTES] [-i IDENTIFIER] NAME FILE\n"
+            "\n"
+            "Drains the records written by shm_logger_new(..., NAME) into FILE until\n"
+            "SIGINT or SIGTERM is received.\n"
+            "  -b BYTES       rotate FILE every BYTES written (appends to FILE otherwise)\n"
+            "  -i IDENTIFIER  identifier of the collector own records\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *identifier = "logger-collector";
+    size_t bytes = 0;
+    struct timespec idle;
+    shm_collector_t *collector;
+    logger_t *sink;
+    int i;
+
+    for (i = 1; i < argc && '-' == argv[i][0]; i++) {
+        if (i + 1 >= argc || '\0' == argv[i][1] || '\0' != argv[i][2]) {
+            _usage(argv[0]);
+        }
+        switch (argv[i][1]) {
+            case 'b':
+                bytes = (size_t) strtoul(argv[++i], NULL, 10);
+                break;
+            case 'i':
+                identifier = argv[++i];
+                break;
+            default:
+                _usage(argv[0]);
+        }
+    }
+    if (i + 2 != argc) {
+        _usage(argv[0]);
+    }
+
+    sink = (bytes > 0) ? rotating_logger_new(identifier, LOG_LEVEL_DEBUG, argv[i + 1], bytes)
+                       : file_logger_new(identifier, LOG_LEVEL_DEBUG, argv[i + 1], LOG_MODE_APPEND);
+    collector = shm_collector_new(argv[i]);
+    if (NULL == sink || NULL == collector) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, _stop);
+    signal(SIGTERM, _stop);
+    idle.tv_sec = 0;
+    idle.tv_nsec = _IDLE_NANOSECONDS;
+    while (_running) {
+        if (0 == shm_collector_drain(collector, sink)) {
+            nanosleep(&idle, NULL);
+        }
+    }
+    shm_collector_drain(collector, sink);
+
+    shm_collector_delete(&collector);
+    logger_delete(&sink);
+    return EXIT_SUCCESS;
+}
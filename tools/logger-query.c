@@ -0,0 +1,471 @@
+/*
+ *  C Source File
+ *
+ *  Author: Davide Di Carlo
+ *  Date:   October 19, 2016
+ *  email:  daddinuz@gmail.com
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger.h"
+#include "logger_index.h"
+#include "logger_frame.h"
+
+
+/*
+ * Usage
+ */
+static void _usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [-f FROM] [-t TO] [-l LEVEL] [-i IDENTIFIER] FILE...\n"
+            "\n"
+            "Prints the records of the given log files matching every filter.\n"
+            "  -f FROM        only records logged at or after FROM (seconds since the epoch, may have a fraction)\n"
+            "  -t TO          only records logged at or before TO (seconds since the epoch, may have a fraction)\n"
+            "  -l LEVEL       only records with level LEVEL or higher (name or number)\n"
+            "  -i IDENTIFIER  only records logged by IDENTIFIER\n"
+            "\n"
+            "Files with a sidecar index (FILE" LOGGER_INDEX_EXTENSION ") are binary-searched for the first\n"
+            "group that can match and only the matching groups are read, files without one\n"
+            "are scanned entirely.\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * Query definition
+ */
+typedef struct _query_t {
+    int64_t from_ns;
+    int64_t to_ns;
+    int level;
+    const char *identifier;
+} _query_t;
+
+static const char *_levels[] = {"DEBUG", "NOTICE", "INFO", "WARNING", "ERROR", "FATAL"};
+static const char *_months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+#define _LEVELS_COUNT   ((int) (sizeof(_levels) / sizeof(_levels[0])))
+#define _LEVELS_MASK(_Level)  (~((1u << (_Level)) - 1u))
+
+static int _parse_level(const char *str) {
+    int i;
+    char *end = NULL;
+    long level = strtol(str, &end, 10);
+    if ('\0' == *end && level >= 0 && level < _LEVELS_COUNT) {
+        return (int) level;
+    }
+    for (i = 0; i < _LEVELS_COUNT; i++) {
+        if (0 == strcasecmp(str, _levels[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Parses seconds since the epoch with an optional fraction, e.g. 1478721497.25
+ */
+static int64_t _parse_time(const char *str) {
+    char *end = NULL;
+    int64_t ns = (int64_t) strtoll(str, &end, 10) * 1000000000, scale = 100000000;
+    if ('.' == *end) {
+        for (end++; *end >= '0' && *end <= '9' && scale > 0; end++, scale /= 10) {
+            ns += (*end - '0') * scale;
+        }
+    }
+    return ns;
+}
+
+/*
+ * Record header parsing
+ */
+static int64_t _days_from_civil(int64_t y, int64_t m, int64_t d) {
+    int64_t era, yoe, doy, doe;
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ * Parses the header of the record starting at `line`:
+ *   LEVEL   [Www Mmm dd hh:mm:ss.nnnnnnnnn yyyy UTC] #SEQUENCE -- (IDENTIFIER): ...
+ * as well as the one written by older versions:
+ *   LEVEL   [Www Mmm dd hh:mm:ss yyyy UTC] -- (IDENTIFIER): ...
+ * returns 0 if the line does not start a record.
+ */
+static int _parse_header(const char *line, const char *end, int *level, int64_t *ns,
+                         const char **identifier, size_t *identifier_length) {
+    char name[16], month[4], fraction[10] = "";
+    int day, hour, minute, second, year, consumed = 0, i;
+    long nanoseconds = 0;
+    const char *close;
+    char head[128];
+    size_t head_length = (size_t) (end - line) < sizeof(head) - 1 ? (size_t) (end - line) : sizeof(head) - 1;
+
+    memcpy(head, line, head_length);
+    head[head_length] = '\0';
+    /* %n is not counted in the result: `consumed` tells whether the whole prefix matched */
+    if (8 != sscanf(head, "%15s [%*3s %3s %d %d:%d:%d.%9[0-9] %d UTC] #%*u -- (%n",
+                    name, month, &day, &hour, &minute, &second, fraction, &year, &consumed) || 0 == consumed) {
+        consumed = 0;
+        if (7 != sscanf(head, "%15s [%*3s %3s %d %d:%d:%d %d UTC] -- (%n",
+                        name, month, &day, &hour, &minute, &second, &year, &consumed) || 0 == consumed) {
+            return 0;
+        }
+    }
+    for (i = 0; i < 9; i++) {
+        nanoseconds = nanoseconds * 10 + ((i < (int) strlen(fraction)) ? fraction[i] - '0' : 0);
+    }
+
+    *level = -1;
+    for (i = 0; i < _LEVELS_COUNT; i++) {
+        if (0 == strcmp(name, _levels[i])) {
+            *level = i;
+        }
+    }
+    for (i = 0; i < 12 && 0 != strcmp(month, _months[i]); i++);
+    if (*level < 0 || 12 == i) {
+        return 0;
+    }
+
+    *ns = (_days_from_civil(year, i + 1, day) * 86400 + hour * 3600 + minute * 60 + second) * (int64_t) 1000000000 + nanoseconds;
+    *identifier = line + consumed;
+    close = *identifier;
+    while (close + 2 < end && !(')' == close[0] && ':' == close[1] && ' ' == close[2])) {
+        close++;
+    }
+    *identifier_length = (size_t) (close - *identifier);
+    return 1;
+}
+
+/*
+ * Prints the records in [begin, end) matching the query.
+ */
+static void _print_matching(const char *begin, const char *end, const _query_t *query) {
+    const char *record = begin, *line = begin, *next;
+    int level = -1, next_level;
+    int64_t ns = 0, next_ns;
+    const char *identifier = NULL, *next_identifier;
+    size_t identifier_length = 0, next_identifier_length;
+    int matches = 0;
+
+    if (begin < end) {
+        _parse_header(begin, end, &level, &ns, &identifier, &identifier_length);
+    }
+    while (line < end) {
+        next = memchr(line, '\n', (size_t) (end - line));
+        next = (NULL == next) ? end : next + 1;
+
+        if (next >= end || _parse_header(next, end, &next_level, &next_ns, &next_identifier, &next_identifier_length)) {
+            matches = level >= query->level && ns >= query->from_ns && ns <= query->to_ns &&
+                      (NULL == query->identifier ||
+                       (strlen(query->identifier) == identifier_length &&
+                        0 == strncmp(query->identifier, identifier, identifier_length)));
+            if (matches) {
+                fwrite(record, 1, (size_t) (next - record), stdout);
+            }
+            if (next < end) {
+                record = next;
+                level = next_level;
+                ns = next_ns;
+                identifier = next_identifier;
+                identifier_length = next_identifier_length;
+            }
+        }
+        line = next;
+    }
+}
+
+/*
+ * Log file access: offsets are in the uncompressed stream, compressed files
+ * are read decoding only the blocks overlapping the requested range.
+ */
+typedef struct _source_t {
+    FILE *file;
+    logger_frame_entry_t *blocks;   /** NULL if the file is not compressed **/
+    size_t count;
+    uint64_t size;                  /** uncompressed size **/
+} _source_t;
+
+static void _source_open(_source_t *source, FILE *file) {
+    logger_frame_entry_t *last;
+    source->file = file;
+    source->blocks = logger_frame_scan(file, &source->count);
+    if (NULL == source->blocks) {
+        fseek(file, 0, SEEK_END);
+        source->size = (uint64_t) ftell(file);
+    } else if (source->count > 0) {
+        last = &source->blocks[source->count - 1];
+        source->size = last->block.raw_offset + last->block.raw_length;
+    } else {
+        source->size = 0;
+    }
+}
+
+static size_t _source_read(_source_t *source, uint64_t offset, char *buffer, size_t length) {
+    size_t lo = 0, hi = source->count, mid, read = 0, n;
+    const logger_frame_block_t *block;
+    char *raw;
+
+    if (NULL == source->blocks) {
+        fseek(source->file, (long) offset, SEEK_SET);
+        return fread(buffer, 1, length, source->file);
+    }
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        block = &source->blocks[mid].block;
+        if (block->raw_offset + block->raw_length <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (; lo < source->count && read < length; lo++) {
+        block = &source->blocks[lo].block;
+        raw = malloc(block->raw_length + 1);
+        if (NULL == raw) {
+            abort();
+        }
+        if (!logger_frame_read_block(source->file, &source->blocks[lo], raw)) {
+            free(raw);
+            break;
+        }
+        n = block->raw_length - (size_t) (offset + read - block->raw_offset);
+        n = (n < length - read) ? n : length - read;
+        memcpy(buffer + read, raw + (offset + read - block->raw_offset), n);
+        read += n;
+        free(raw);
+    }
+    return read;
+}
+
+/*
+ * Returns the start of the last record beginning in (begin, end), begin if there is none.
+ */
+static const char *_last_record(const char *begin, const char *end) {
+    const char *line, *identifier;
+    size_t identifier_length;
+    int64_t ns;
+    int level;
+
+    for (line = end - 1; line > begin; line--) {
+        if ('\n' == line[-1] && _parse_header(line, end, &level, &ns, &identifier, &identifier_length)) {
+            return line;
+        }
+    }
+    return begin;
+}
+
+/*
+ * Reads the range in chunks: the record straddling the end of a chunk is
+ * carried over to the next one, the buffer grows only for records larger
+ * than a whole chunk.
+ */
+#define _QUERY_CHUNK_SIZE   1048576
+
+static void _query_range(_source_t *source, uint64_t offset, uint64_t length, const _query_t *query) {
+    size_t capacity = _QUERY_CHUNK_SIZE, used = 0, wanted, read;
+    const char *split;
+    char *buffer;
+
+    if (0 == length) {
+        return;
+    }
+    buffer = malloc(capacity);
+    if (NULL == buffer) {
+        abort();
+    }
+    while (length > 0) {
+        if (used == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            if (NULL == buffer) {
+                abort();
+            }
+        }
+        wanted = (capacity - used < length) ? capacity - used : (size_t) length;
+        read = _source_read(source, offset, buffer + used, wanted);
+        if (0 == read) {
+            break;
+        }
+        offset += read;
+        length -= read;
+        used += read;
+        if (length > 0) {
+            split = _last_record(buffer, buffer + used);
+            _print_matching(buffer, split, query);
+            used -= (size_t) (split - buffer);
+            memmove(buffer, split, used);
+        }
+    }
+    _print_matching(buffer, buffer + used, query);
+    free(buffer);
+}
+
+/*
+ * Index loading
+ */
+static logger_index_entry_t *_load_index(const char *file_path, size_t *count) {
+    logger_index_header_t header;
+    logger_index_entry_t *entries = NULL;
+    long size;
+    char *index_path = malloc(strlen(file_path) + sizeof(LOGGER_INDEX_EXTENSION));
+    FILE *index;
+
+    if (NULL == index_path) {
+        abort();
+    }
+    strcpy(index_path, file_path);
+    strcat(index_path, LOGGER_INDEX_EXTENSION);
+    index = fopen(index_path, "rb");
+    free(index_path);
+    *count = 0;
+    if (NULL == index) {
+        return NULL;
+    }
+
+    if (1 != fread(&header, sizeof(header), 1, index) ||
+        0 != memcmp(header.magic, LOGGER_INDEX_MAGIC, sizeof(header.magic)) ||
+        LOGGER_INDEX_VERSION != header.version) {
+        fprintf(stderr, "Ignoring invalid index for: '%s'\n", file_path);
+        fclose(index);
+        return NULL;
+    }
+
+    fseek(index, 0, SEEK_END);
+    size = ftell(index) - (long) sizeof(header);
+    fseek(index, (long) sizeof(header), SEEK_SET);
+    entries = malloc((size_t) size + 1);
+    if (NULL == entries) {
+        abort();
+    }
+    *count = fread(entries, sizeof(*entries), (size_t) size / sizeof(*entries), index);
+    fclose(index);
+    return entries;
+}
+
+/*
+ * Returns the first entry whose group may hold records at or after from_ns:
+ * `latest` is the running maximum of max_ns, which unlike max_ns itself is
+ * sorted along the offset-ordered entries.
+ */
+static size_t _first_candidate(const int64_t *latest, size_t count, int64_t from_ns) {
+    size_t lo = 0, hi = count, mid;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (latest[mid] < from_ns) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Queries a single log file
+ */
+static void _query_file(const char *file_path, const _query_t *query) {
+    FILE *file = fopen(file_path, "rb");
+    logger_index_entry_t *entries;
+    int64_t *latest;
+    uint64_t covered = 0;
+    _source_t source;
+    size_t count, first, i;
+
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open file: '%s'\n", file_path);
+        return;
+    }
+    _source_open(&source, file);
+
+    entries = _load_index(file_path, &count);
+    latest = malloc((count + 1) * sizeof(*latest));
+    if (NULL == latest) {
+        abort();
+    }
+    for (i = 0; i < count; i++) {
+        latest[i] = (i > 0 && latest[i - 1] > entries[i].max_ns) ? latest[i - 1] : entries[i].max_ns;
+    }
+    first = _first_candidate(latest, count, query->from_ns);
+
+    /*
+     * entries are in file order, bytes they do not cover (records written before the
+     * index was enabled, groups lost in a crash, the group being filled) are scanned
+     */
+    for (i = 0; i < count; i++) {
+        if (entries[i].offset > covered) {
+            _query_range(&source, covered, entries[i].offset - covered, query);
+        }
+        if (i >= first && entries[i].max_ns >= query->from_ns && entries[i].min_ns <= query->to_ns &&
+            0 != (entries[i].levels & _LEVELS_MASK(query->level))) {
+            _query_range(&source, entries[i].offset, entries[i].length, query);
+        }
+        if (entries[i].offset + entries[i].length > covered) {
+            covered = entries[i].offset + entries[i].length;
+        }
+    }
+    if (source.size > covered) {
+        _query_range(&source, covered, source.size - covered, query);
+    }
+
+    free(source.blocks);
+    free(latest);
+    free(entries);
+    fclose(file);
+}
+
+int main(int argc, char *argv[]) {
+    _query_t query;
+    int i;
+
+    query.from_ns = INT64_MIN;
+    query.to_ns = INT64_MAX;
+    query.level = LOG_LEVEL_DEBUG;
+    query.identifier = NULL;
+
+    for (i = 1; i < argc && '-' == argv[i][0]; i++) {
+        if (i + 1 >= argc || '\0' == argv[i][1] || '\0' != argv[i][2]) {
+            _usage(argv[0]);
+        }
+        switch (argv[i][1]) {
+            case 'f':
+                query.from_ns = _parse_time(argv[++i]);
+                break;
+            case 't':
+                i++;
+                /* whole seconds include the entire second */
+                query.to_ns = _parse_time(argv[i]) + ((NULL == strchr(argv[i], '.')) ? 999999999 : 0);
+                break;
+            case 'l':
+                if ((query.level = _parse_level(argv[++i])) < 0) {
+                    _usage(argv[0]);
+                }
+                break;
+            case 'i':
+                query.identifier = argv[++i];
+                break;
+            default:
+                _usage(argv[0]);
+        }
+    }
+    if (i >= argc) {
+        _usage(argv[0]);
+    }
+
+    for (; i < argc; i++) {
+        _query_file(argv[i], &query);
+    }
+    return EXIT_SUCCESS;
+}